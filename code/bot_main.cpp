@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "algebra.h"
+#include "memory.h"
+#include "network.h"
+#include "protocol.h"
+#include "snapshot.h"
+
+#include "memory.cpp"
+#include "network.cpp"
+#include "protocol.cpp"
+#include "snapshot.cpp"
+
+// Headless load generator. Every bot is a client with its own socket that does the
+// handshake, walks around sending an input packet per tick and decodes the states
+// so its acks keep the server delta compression working like a real client
+
+typedef std::chrono::high_resolution_clock::time_point TimePoint;
+
+enum BotState {
+    BOT_STATE_HELLO,
+    BOT_STATE_WELCOMED
+};
+
+struct Bot {
+    UDPSocket socket;
+    BotState state;
+    uint32 cookie;
+    bool hasChallenge;
+    float64 lastHelloTime;
+    float64 lastHeardTime;
+
+    uint32 uid;
+    uint32 serverTick;
+    // of the server that welcomed the bot
+    int32 tickRate;
+    uint32 inputSequence;
+    uint32 lastAppliedInput;
+
+    // the bot walks in a random direction and picks a new one from time to time
+    int32 inputX;
+    int32 inputY;
+    float64 nextTurnTime;
+    // input the bot pressed the action button in, sometimes it does when it turns
+    uint32 actionSequence;
+
+    Connection connection;
+    SnapshotHistory *snapshots;
+};
+
+struct BotStats {
+    uint64 bytesSent;
+    uint64 bytesReceived;
+    uint32 packetsSent;
+    uint32 packetsReceived;
+    uint32 statesDropped;
+    uint32 connects;
+    uint32 timeouts;
+};
+
+struct BotConfig {
+    int32 botCount;
+    uint32 ip;
+    uint16 port;
+    // 0 sends at the tick rate of the server
+    int32 tickRate;
+    float32 seconds;
+    float32 reportInterval;
+};
+
+static const int32   DefaultBotCount = 100;
+// the server only applies one input per tick, the bots send at its tick rate from the welcome
+// and at this one until a welcome arrives
+static const int32   DefaultBotTickRate = 30;
+static const float32 DefaultBotReportInterval = 5.0f;
+static const float32 BotTimeBetweenHellos = 1.0f;
+static const float32 BotMinTurnTime = 0.5f;
+static const float32 BotMaxTurnTime = 3.0f;
+// one turn in this many also presses the action button
+static const uint32  BotActionChance = 4;
+static const int32   BotMaxPacketPerTick = 16;
+
+static uint32 BotRandomState = 0x9E3779B9;
+
+// seconds since start, read from the clock every time so the packet times aren't rounded to the tick
+float64 BotTime(TimePoint start) {
+    TimePoint now = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count() / 1000000000.0;
+}
+
+uint32 BotRandom() {
+    BotRandomState ^= BotRandomState << 13;
+    BotRandomState ^= BotRandomState >> 17;
+    BotRandomState ^= BotRandomState << 5;
+    return BotRandomState;
+}
+
+float32 BotRandomRange(float32 min, float32 max) {
+    return min + (max - min) * ((float32)(BotRandom() & 0xFFFFFF) / (float32)0xFFFFFF);
+}
+
+void BotSend(Bot *bot, BotStats *stats, void *buffer, int32 size, UDPAddress *address) {
+    int32 sentBytes = UDPSocketSendTo(&bot->socket, buffer, size, address);
+    if(sentBytes == size) {
+        stats->bytesSent += size;
+        stats->packetsSent++;
+    }
+}
+
+void BotReset(Bot *bot) {
+    bot->state = BOT_STATE_HELLO;
+    bot->hasChallenge = false;
+    // the first hello goes out on the next tick
+    bot->lastHelloTime = -BotTimeBetweenHellos;
+    bot->serverTick = 0;
+    bot->inputSequence = 0;
+    bot->lastAppliedInput = 0;
+    SnapshotHistoryClear(bot->snapshots);
+}
+
+// Decode the state against its baseline and keep it, the tick we ack is the newest one
+// we could rebuild
+bool BotProcessState(Bot *bot, BitStream *inStream, float64 time) {
+    ConnectionHeader connectionHeader;
+    ConnectionReadHeader(inStream, &connectionHeader);
+    StateHeader header;
+    ReadStateHeader(inStream, &header);
+    if(inStream->overflow || !ConnectionProcessHeader(&bot->connection, &connectionHeader, time)) {
+        return false;
+    }
+    if((int32)(header.tick - bot->serverTick) <= 0) {
+        return false;
+    }
+    Snapshot *baseline = nullptr;
+    if(header.baselineDistance != 0) {
+        baseline = SnapshotHistoryGet(bot->snapshots, header.tick - header.baselineDistance);
+        if(baseline == nullptr) {
+            return false;
+        }
+    }
+    Snapshot snapshot;
+    if(!SnapshotReadDelta(inStream, baseline, &snapshot)) {
+        return false;
+    }
+    Snapshot *stored = SnapshotHistoryInsert(bot->snapshots, header.tick);
+    memcpy(stored->entities, snapshot.entities, sizeof(EntitySnapshot) * snapshot.entityCount);
+    stored->entityCount = snapshot.entityCount;
+    bot->serverTick = header.tick;
+    bot->lastAppliedInput = header.lastAppliedInput;
+    return true;
+}
+
+void BotReceive(Bot *bot, BotStats *stats, TimePoint start) {
+    uint8 buffer[MaxDatagramSize];
+    UDPAddress fromAddress;
+    for(int32 i = 0; i < BotMaxPacketPerTick; ++i) {
+        int32 bytes = UDPSocketReceiveFrom(&bot->socket, buffer, MaxDatagramSize, &fromAddress);
+        if(bytes <= 0) {
+            break;
+        }
+        float64 time = BotTime(start);
+        stats->bytesReceived += bytes;
+        stats->packetsReceived++;
+
+        BitStream inStream;
+        if(!PacketOpen(buffer, bytes, &inStream)) {
+            continue;
+        }
+        int32 type = BitStreamReadInt(&inStream, 0, PACKET_TYPE_COUNT - 1);
+        if(type == PACKET_TYPE_CHALLENGE && bot->state == BOT_STATE_HELLO) {
+            uint32 cookie = BitStreamReadBits(&inStream, 32);
+            if(!inStream.overflow) {
+                bot->cookie = cookie;
+                bot->hasChallenge = true;
+                // answer right away instead of waiting for the next hello
+                bot->lastHelloTime = -BotTimeBetweenHellos;
+            }
+        }
+        else if(type == PACKET_TYPE_WELCOME && bot->state == BOT_STATE_HELLO) {
+            WelcomePacket welcome;
+            ReadWelcomePacket(&inStream, &welcome);
+            if(!inStream.overflow) {
+                bot->uid = welcome.uid;
+                bot->serverTick = welcome.tick;
+                bot->tickRate = welcome.tickRate;
+                bot->state = BOT_STATE_WELCOMED;
+                bot->lastHeardTime = time;
+                ConnectionInitialize(&bot->connection);
+                stats->connects++;
+            }
+        }
+        else if(type == PACKET_TYPE_STATE && bot->state == BOT_STATE_WELCOMED) {
+            bot->lastHeardTime = time;
+            if(!BotProcessState(bot, &inStream, time)) {
+                stats->statesDropped++;
+            }
+        }
+    }
+}
+
+void BotUpdate(Bot *bot, BotStats *stats, UDPAddress *serverAddress, TimePoint start) {
+    uint8 buffer[MaxDatagramSize];
+    BotReceive(bot, stats, start);
+    float64 time = BotTime(start);
+
+    if(bot->state == BOT_STATE_HELLO) {
+        if(time - bot->lastHelloTime >= BotTimeBetweenHellos) {
+            PacketType type = bot->hasChallenge ? PACKET_TYPE_RESPONSE : PACKET_TYPE_HELLO;
+            int32 packetSize = WriteConnectPacket(buffer, type, bot->cookie);
+            BotSend(bot, stats, buffer, packetSize, serverAddress);
+            bot->lastHelloTime = time;
+        }
+        return;
+    }
+
+    if(time - bot->lastHeardTime > ConnectionTimeout) {
+        stats->timeouts++;
+        BotReset(bot);
+        return;
+    }
+
+    if(time >= bot->nextTurnTime) {
+        bot->inputX = (int32)(BotRandom() % 3) - 1;
+        bot->inputY = (int32)(BotRandom() % 3) - 1;
+        bot->nextTurnTime = time + BotRandomRange(BotMinTurnTime, BotMaxTurnTime);
+        if(BotRandom() % BotActionChance == 0) {
+            bot->actionSequence = bot->inputSequence + 1;
+        }
+    }
+
+    // the bot doesn't predict, it only needs to resend the inputs the server hasn't applied.
+    // they are all the current direction so there is nothing to keep
+    uint32 sequence = ++bot->inputSequence;
+    int32 unackedCount = (int32)Min(sequence - bot->lastAppliedInput, (uint32)MaxInputSampleCount);
+    int32 samplesCount = Min(InputRedundancy(bot->connection.packetLoss), unackedCount);
+    // bots don't interpolate, they see the states as soon as they arrive
+    BitStream outStream = BeginInputPacket(buffer, MaxDatagramSize, &bot->connection, time, bot->uid,
+                                           bot->serverTick, 0.0f, sequence, samplesCount);
+    for(int32 i = 0; i < samplesCount; ++i) {
+        WriteInputSample(&outStream, (float32)bot->inputX, (float32)bot->inputY, (sequence - i) == bot->actionSequence);
+    }
+    int32 packetSize = PacketEnd(&outStream);
+    BotSend(bot, stats, buffer, packetSize, serverAddress);
+}
+
+// Read the bot sockets as the datagrams arrive until the next tick is due, instead of
+// sleeping through the tick and finding them all at once
+void BotWaitForTick(Bot *bots, pollfd *pollFds, int32 botCount, BotStats *stats, TimePoint start, TimePoint nextTick) {
+    for(;;) {
+        TimePoint now = std::chrono::high_resolution_clock::now();
+        if(now >= nextTick) {
+            return;
+        }
+        float64 timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - now).count() / 1000000000.0;
+        for(int32 i = 0; i < botCount; ++i) {
+            pollFds[i].fd = bots[i].socket.handle;
+            pollFds[i].events = POLLIN;
+            pollFds[i].revents = 0;
+        }
+#if __linux__
+        timespec time;
+        time.tv_sec = (time_t)timeout;
+        time.tv_nsec = (long)((timeout - (float64)time.tv_sec) * 1000000000.0);
+        int32 result = ppoll(pollFds, botCount, &time, nullptr);
+#else
+        // round up, waking early would spin until the tick
+        int32 result = poll(pollFds, botCount, (int32)(timeout * 1000.0) + 1);
+#endif
+        if(result < 0 && UDPGetLastError() != EINTR) {
+            std::this_thread::sleep_until(nextTick);
+            return;
+        }
+        for(int32 i = 0; i < botCount && result > 0; ++i) {
+            if(pollFds[i].revents & POLLIN) {
+                BotReceive(bots + i, stats, start);
+                result--;
+            }
+        }
+    }
+}
+
+void BotRequestStats(UDPSocket *socket, UDPAddress *serverAddress) {
+    uint8 buffer[MinConnectPacketSize];
+    int32 packetSize = WriteConnectPacket(buffer, PACKET_TYPE_STATS, 0);
+    UDPSocketSendTo(socket, buffer, packetSize, serverAddress);
+}
+
+bool BotReceiveStats(UDPSocket *socket, StatsPacket *stats) {
+    uint8 buffer[MaxDatagramSize];
+    UDPAddress fromAddress;
+    bool received = false;
+    int32 bytes;
+    while((bytes = UDPSocketReceiveFrom(socket, buffer, MaxDatagramSize, &fromAddress)) > 0) {
+        BitStream inStream;
+        if(PacketOpen(buffer, bytes, &inStream) &&
+           BitStreamReadInt(&inStream, 0, PACKET_TYPE_COUNT - 1) == PACKET_TYPE_STATS) {
+            ReadStatsPacket(&inStream, stats);
+            received = !inStream.overflow;
+        }
+    }
+    return received;
+}
+
+float32 Percentile(float32 *sortedValues, int32 count, float32 percentile) {
+    if(count == 0) {
+        return 0;
+    }
+    int32 index = Min((int32)(percentile * (float32)count), count - 1);
+    return sortedValues[index];
+}
+
+void BotReport(Bot *bots, int32 botCount, BotStats *stats, float32 elapsed, float32 *rtts,
+               StatsPacket *serverStats, bool hasServerStats) {
+    int32 connectedCount = 0;
+    float32 lossTotal = 0;
+    for(int32 i = 0; i < botCount; ++i) {
+        if(bots[i].state == BOT_STATE_WELCOMED && bots[i].connection.hasRemoteAck) {
+            rtts[connectedCount++] = bots[i].connection.rtt;
+            lossTotal += bots[i].connection.packetLoss;
+        }
+    }
+    std::sort(rtts, rtts + connectedCount);
+
+    printf("bots: %d/%d connects: %u timeouts: %u dropped states: %u\n", connectedCount, botCount,
+           stats->connects, stats->timeouts, stats->statesDropped);
+    printf("  out: %.1f KB/s %.0f packets/s in: %.1f KB/s %.0f packets/s\n",
+           stats->bytesSent / 1024.0 / elapsed, stats->packetsSent / elapsed,
+           stats->bytesReceived / 1024.0 / elapsed, stats->packetsReceived / elapsed);
+    printf("  rtt p50: %.1fms p90: %.1fms p99: %.1fms max: %.1fms loss: %.2f%%\n",
+           Percentile(rtts, connectedCount, 0.5f) * 1000.0f, Percentile(rtts, connectedCount, 0.9f) * 1000.0f,
+           Percentile(rtts, connectedCount, 0.99f) * 1000.0f,
+           (connectedCount ? rtts[connectedCount - 1] : 0) * 1000.0f,
+           connectedCount ? lossTotal / connectedCount * 100.0f : 0.0f);
+    if(hasServerStats) {
+        // with several shards this is the one the stats socket hashes to
+        printf("  server ");
+        PrintStatsPacket(serverStats);
+    }
+}
+
+int32 main(int32 argc, char **argv) {
+    BotConfig config;
+    config.botCount = DefaultBotCount;
+    config.ip = IP(127, 0, 0, 1);
+    config.port = 35000;
+    config.tickRate = 0;
+    config.seconds = 0;
+    config.reportInterval = DefaultBotReportInterval;
+    for(int32 i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--bots") == 0 && i + 1 < argc) {
+            config.botCount = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--ip") == 0 && i + 1 < argc) {
+            uint32 a, b, c, d;
+            if(sscanf(argv[++i], "%u.%u.%u.%u", &a, &b, &c, &d) != 4) {
+                printf("invalid ip %s\n", argv[i]);
+                return 1;
+            }
+            config.ip = IP(a, b, c, d);
+        }
+        else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            config.port = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config.tickRate = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config.seconds = (float32)atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            config.reportInterval = (float32)atof(argv[++i]);
+        }
+        else {
+            printf("usage: bot [--bots count] [--ip a.b.c.d] [--port port] [--tick-rate hz] [--seconds seconds] [--report seconds]\n");
+            return 1;
+        }
+    }
+    if(config.botCount <= 0 || config.tickRate < 0 || config.reportInterval <= 0) {
+        printf("invalid bot count %d, tick rate %d or report interval %f\n", config.botCount, config.tickRate, config.reportInterval);
+        return 1;
+    }
+
+    // every bot has its own socket, make sure we can open them
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)config.botCount + 64) {
+        limit.rlim_cur = Min((rlim_t)config.botCount + 64, limit.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Memory memory;
+    memory.size = sizeof(Bot) * config.botCount + sizeof(SnapshotHistory) * config.botCount +
+                  sizeof(float32) * config.botCount + sizeof(pollfd) * config.botCount;
+    memory.used = 0;
+    memory.data = (uint8 *)malloc(memory.size);
+    Arena arena = ArenaCreate(&memory, memory.size);
+
+    Bot *bots = (Bot *)ArenaPushSize(&arena, sizeof(Bot) * config.botCount);
+    float32 *rtts = (float32 *)ArenaPushSize(&arena, sizeof(float32) * config.botCount);
+    pollfd *pollFds = (pollfd *)ArenaPushSize(&arena, sizeof(pollfd) * config.botCount);
+    UDPAddress bindAddress = UDPAddresCreate(IP(0, 0, 0, 0), 0);
+    for(int32 i = 0; i < config.botCount; ++i) {
+        Bot *bot = bots + i;
+        memset(bot, 0, sizeof(Bot));
+        bot->snapshots = (SnapshotHistory *)ArenaPushSize(&arena, sizeof(SnapshotHistory));
+        bot->socket = UDPSocketCreate();
+        UDPSocketBind(&bot->socket, &bindAddress);
+        UDPSocketSetNonBlockingMode(&bot->socket, true);
+        BotReset(bot);
+    }
+    UDPSocket statsSocket = UDPSocketCreate();
+    UDPSocketBind(&statsSocket, &bindAddress);
+    UDPSocketSetNonBlockingMode(&statsSocket, true);
+
+    UDPAddress serverAddress = UDPAddresCreate(config.ip, config.port);
+    printf("bots: %d server port: %d\n", config.botCount, config.port);
+
+    int32 tickRate = config.tickRate > 0 ? config.tickRate : DefaultBotTickRate;
+    BotStats stats;
+    memset(&stats, 0, sizeof(BotStats));
+    StatsPacket serverStats;
+    bool hasServerStats = false;
+
+    TimePoint start = std::chrono::high_resolution_clock::now();
+    TimePoint nextTick = start;
+    float64 lastReport = 0;
+    for(;;) {
+        BotWaitForTick(bots, pollFds, config.botCount, &stats, start, nextTick);
+        nextTick += std::chrono::nanoseconds(1000000000LL / tickRate);
+
+        float64 time = BotTime(start);
+        for(int32 i = 0; i < config.botCount; ++i) {
+            BotUpdate(bots + i, &stats, &serverAddress, start);
+            if(config.tickRate == 0 && bots[i].state == BOT_STATE_WELCOMED) {
+                tickRate = bots[i].tickRate;
+            }
+        }
+
+        if(BotReceiveStats(&statsSocket, &serverStats)) {
+            hasServerStats = true;
+        }
+        if(time - lastReport >= config.reportInterval) {
+            BotReport(bots, config.botCount, &stats, (float32)(time - lastReport), rtts, &serverStats, hasServerStats);
+            memset(&stats, 0, sizeof(BotStats));
+            lastReport = time;
+            BotRequestStats(&statsSocket, &serverAddress);
+        }
+        if(config.seconds > 0 && time >= config.seconds) {
+            break;
+        }
+        // if we can't keep up skip the ticks instead of bursting
+        if(std::chrono::high_resolution_clock::now() > nextTick) {
+            nextTick = std::chrono::high_resolution_clock::now();
+        }
+    }
+
+    for(int32 i = 0; i < config.botCount; ++i) {
+        UDPSocketDestroy(&bots[i].socket);
+    }
+    UDPSocketDestroy(&statsSocket);
+    free(memory.data);
+    return 0;
+}
@@ -34,9 +34,17 @@ cp ../assets/textures/tilemap.png ../build/client.app/Contents/Resources/tilemap
 cp ../assets/tilemaps/tilemap.csv ../build/client.app/Contents/Resources/tilemap.csv
 cp ../assets/tilemaps/collision.csv ../build/client.app/Contents/Resources/collision.csv
 
-clang -g -O0 -DHANDMADE_DEBUG -lstdc++ -std=c++11 -o ../build/server server_main.cpp
+clang -g -O0 -DHANDMADE_DEBUG -lstdc++ -std=c++11 -pthread -o ../build/server server_main.cpp
 
 echo Server compiled
 
+clang -g -O0 -DHANDMADE_DEBUG -lstdc++ -std=c++11 -pthread -o ../build/bot bot_main.cpp
+
+echo Bot compiled
+
+clang -O2 -lstdc++ -std=c++11 -o ../build/hashmap_bench hashmap_bench.cpp
+
+echo HashMap benchmark compiled
+
 echo Finished!
 
@@ -73,8 +73,10 @@ void GameInitialize(Memory *memory, GameSound *sound, GameInput *input) {
     gameState->assetsArena = ArenaCreate(memory, MB(50));
     gameState->networkArena = ArenaCreate(memory, MB(10));
 
-    gameState->entityPool = MemoryPoolCreate(memory, MaxEntityCount, sizeof(Entity));
-    gameState->networkToEntity.Initialize(&gameState->networkArena, 128);
+    gameState->entities.Initialize(&gameState->networkArena, MaxEntityCount);
+    gameState->networkToEntity.Initialize(&gameState->networkArena, 128, true);
+    gameState->snapshots = ArenaPushStruct(&gameState->networkArena, SnapshotHistory);
+    SnapshotHistoryClear(gameState->snapshots);
 
     gameState->oliviaRodrigo = sound->Load(&gameState->assetsArena, "test", false, true);
     gameState->missionCompleted = sound->Load(&gameState->assetsArena, "test1", false, false);
@@ -101,8 +103,8 @@ void GameInitialize(Memory *memory, GameSound *sound, GameInput *input) {
     gameState->tiles = collision.tiles;
 
     gameState->totalGameTime = 0;
-    gameState->inputSamplesCount = 0;
-    gameState->lastTimeStamp = 0;
+    gameState->inputSequence = 0;
+    gameState->tickAccumulator = 0;
 
     gameState->socket = UDPSocketCreate();
     gameState->address = UDPAddresCreate(IP(127, 0, 0, 1), 0);
@@ -113,183 +115,433 @@ void GameInitialize(Memory *memory, GameSound *sound, GameInput *input) {
     gameState->sendAddress = UDPAddresCreate(IP(127, 0, 0, 1), 35000);
 }
 
-void GameUpdateAndRender(Memory *memory, GameSound *sound, GameInput *input, GameBackBuffer *backBuffer) {
+// Rewind our player to the state the server sent and replay the inputs it hasn't applied yet
+void ReconcilePlayer(GameState *gameState, EntitySnapshot *entitySnapshot, uint32 lastAppliedInput) {
+    Entity *hero = GetEntity(gameState, gameState->entity);
+    hero->pos = entitySnapshot->pos;
+    hero->vel = entitySnapshot->vel;
 
-    GameState *gameState = (GameState *)memory->data;
-    float32 dt = input->deltaTime;
-    if(gameState->clientState == CLIENT_STATE_HELLO) {
-        char buffer[1200];
-        if(gameState->timePassFromLastInputPacket >= 1) {
+    uint32 pendingCount = gameState->inputSequence - lastAppliedInput;
+    if(pendingCount > (uint32)InputBufferSize) {
+        // too far behind to replay, keep the server state
+        return;
+    }
+    for(uint32 sequence = lastAppliedInput + 1; sequence != gameState->inputSequence + 1; ++sequence) {
+        InputState *input = gameState->inputs + (sequence % InputBufferSize);
+        SimulatePlayer(gameState, hero, input->inputX, input->inputY, gameState->tickDt);
+    }
+}
+
+void InterpolationPush(Entity *entity, float64 time, Vec2 pos, Vec2 vel) {
+    if(entity->interpolationSampleCount > 0 &&
+       entity->interpolationSamples[entity->interpolationSampleCount - 1].time >= time) {
+        return;
+    }
+    if(entity->interpolationSampleCount == InterpolationBufferSize) {
+        memmove(entity->interpolationSamples, entity->interpolationSamples + 1,
+                sizeof(InterpolationSample) * (InterpolationBufferSize - 1));
+        entity->interpolationSampleCount--;
+    }
+    InterpolationSample *sample = entity->interpolationSamples + entity->interpolationSampleCount++;
+    sample->time = time;
+    sample->pos = pos;
+    sample->vel = vel;
+}
+
+// Place a remote entity at renderTime between the two states around it, the states
+// older than that are not needed anymore
+void InterpolateEntity(Entity *entity, float64 renderTime, float32 tickDt) {
+    int32 count = entity->interpolationSampleCount;
+    if(count == 0) {
+        return;
+    }
+    InterpolationSample *samples = entity->interpolationSamples;
+
+    int32 consumed = 0;
+    while(consumed + 1 < count && samples[consumed + 1].time <= renderTime) {
+        ++consumed;
+    }
+    if(consumed > 0) {
+        memmove(samples, samples + consumed, sizeof(InterpolationSample) * (count - consumed));
+        count -= consumed;
+        entity->interpolationSampleCount = count;
+    }
+
+    InterpolationSample *from = samples;
+    if(renderTime <= from->time) {
+        entity->pos = from->pos;
+        entity->vel = from->vel;
+    }
+    else if(count > 1) {
+        InterpolationSample *to = samples + 1;
+        float32 t = (float32)((renderTime - from->time) / (to->time - from->time));
+        entity->pos = from->pos + (to->pos - from->pos) * t;
+        entity->vel = to->vel;
+    }
+    else {
+        // we ran out of states, keep moving with the last velocity for a moment.
+        // vel is what the entity moved in its last simulated tick
+        float32 ahead = (float32)Min(renderTime - from->time, (float64)MaxExtrapolationTime);
+        entity->pos = from->pos + from->vel * (ahead / tickDt);
+        entity->vel = from->vel;
+    }
+}
+
+// Track the offset between our clock and the server timeline and the jitter of the
+// state packets, the interpolation delay follows the jitter
+void UpdateServerClock(GameState *gameState, float64 serverTime) {
+    float64 offset = serverTime - gameState->totalGameTime;
+    if(!gameState->hasServerTime) {
+        gameState->serverTimeOffset = offset;
+        gameState->stateInterval = gameState->tickDt;
+        gameState->stateJitter = 0;
+        gameState->interpolationDelay = MaxInterpolationDelay * 0.5f;
+        gameState->hasServerTime = true;
+    }
+    else {
+        float32 deviation = (float32)(offset - gameState->serverTimeOffset);
+        gameState->stateJitter += (fabsf(deviation) - gameState->stateJitter) * StateJitterSmoothing;
+        gameState->serverTimeOffset += deviation * ClockSmoothing;
+        float32 interval = (float32)(serverTime - gameState->lastStateTime);
+        gameState->stateInterval += (interval - gameState->stateInterval) * ClockSmoothing;
+    }
+    gameState->lastStateTime = serverTime;
+
+    float32 targetDelay = gameState->stateInterval + gameState->stateJitter * InterpolationJitterScale;
+    targetDelay = Min(Max(targetDelay, MinInterpolationDelay), MaxInterpolationDelay);
+    gameState->interpolationDelay += (targetDelay - gameState->interpolationDelay) * InterpolationDelaySmoothing;
+}
+
+// Rebuild the snapshot from its baseline and update our entities to match it.
+// Returns false if the state was dropped
+bool ProcessStatePacket(GameState *gameState, BitStream *inStream) {
+    StateHeader header;
+    ReadStateHeader(inStream, &header);
+    uint32 tick = header.tick;
+    uint32 baselineId = header.baselineDistance ? tick - header.baselineDistance : 0;
+    uint32 lastAppliedInput = header.lastAppliedInput;
+    if(inStream->overflow) {
+        return false;
+    }
 
-            MemoryStream outStream = MemoryStreamCreate(buffer, 1200);
-            MemoryStreamWrite(&outStream, (void *)&PacketHeader, sizeof(int32));
-            MemoryStreamWrite(&outStream, (void *)&PacketTypeHello, sizeof(int32));
+    // drop states older than the one we already have
+    if((int32)(tick - gameState->serverTick) <= 0) {
+        return false;
+    }
+
+    Snapshot *baseline = nullptr;
+    if(baselineId != 0) {
+        baseline = SnapshotHistoryGet(gameState->snapshots, baselineId);
+        if(baseline == nullptr) {
+            // we don't have the baseline anymore, wait for the server to send a new one
+            return false;
+        }
+    }
+
+    Snapshot snapshot;
+    bool updated[MaxSnapshotEntityCount];
+    if(!SnapshotReadDelta(inStream, baseline, &snapshot, updated)) {
+        printf("bad State packet\n");
+        return false;
+    }
 
-            int sentBytes = UDPSocketSendTo(&gameState->socket, buffer, 1200, &gameState->sendAddress);
-            if (sentBytes != 1200) {
-                printf( "failed to send Hello packet\n" );
+    // remove the entities that are not in the new snapshot
+    Snapshot *previous = SnapshotHistoryGet(gameState->snapshots, gameState->serverTick);
+    if(previous) {
+        for(int32 i = 0; i < previous->entityCount; ++i) {
+            uint32 networkID = previous->entities[i].uid;
+            if(SnapshotFind(&snapshot, networkID) == nullptr) {
+                SlotHandle entity = gameState->networkToEntity.Get(networkID);
+                if(entity && entity != gameState->entity) {
+                    RemoveEntity(gameState, entity);
+                    gameState->networkToEntity.Remove(networkID);
+                }
             }
-            else {
-                printf( "Hello Packet send\n" );
+        }
+    }
+
+    Snapshot *stored = SnapshotHistoryInsert(gameState->snapshots, tick);
+    memcpy(stored->entities, snapshot.entities, sizeof(EntitySnapshot) * snapshot.entityCount);
+    stored->entityCount = snapshot.entityCount;
+    gameState->serverTick = tick;
+
+    float64 serverTime = (float64)tick * gameState->tickDt;
+    UpdateServerClock(gameState, serverTime);
+
+    for(int32 i = 0; i < snapshot.entityCount; ++i) {
+        EntitySnapshot *entitySnapshot = snapshot.entities + i;
+        SlotHandle handle = gameState->networkToEntity.Get(entitySnapshot->uid);
+        Entity *entity = GetEntity(gameState, handle);
+        if(handle == gameState->entity) {
+            // the replay is done once per frame with the newest state
+            gameState->heroState = *entitySnapshot;
+            gameState->heroLastAppliedInput = lastAppliedInput;
+            gameState->hasHeroState = true;
+        }
+        else if(entity) {
+            // the entities the packet didn't write still have the state of the baseline,
+            // it is not the state at this tick if the server deferred them
+            if(updated[i]) {
+                InterpolationPush(entity, serverTime, entitySnapshot->pos, entitySnapshot->vel);
             }
+        }
+        else {
+            Entity *newEntity = CreatePlayer(gameState);
+            newEntity->uid = entitySnapshot->uid;
+            newEntity->pos = entitySnapshot->pos;
+            newEntity->vel = entitySnapshot->vel;
+            newEntity->interpolationSampleCount = 0;
+            InterpolationPush(newEntity, serverTime, entitySnapshot->pos, entitySnapshot->vel);
+            gameState->networkToEntity.Add(entitySnapshot->uid, newEntity->handle);
+        }
+    }
+    return true;
+}
 
-            gameState->timePassFromLastInputPacket -= 1;
+// Drain the socket up to MaxPacketPerFrameCount datagrams so the states don't queue up
+// when the server sends faster than we render. Every state feeds the interpolation of the
+// remote entities but our player is only reconciled with the newest one
+void ReceivePackets(GameState *gameState) {
+    ReceiveStats *stats = &gameState->receiveStats;
+    UDPDatagram datagrams[MaxDatagramBatchCount];
+    int32 receivedCount = 0;
+    gameState->hasHeroState = false;
+
+    while(receivedCount < MaxPacketPerFrameCount) {
+        int32 batchCount = Min(MaxDatagramBatchCount, MaxPacketPerFrameCount - receivedCount);
+        for(int32 i = 0; i < batchCount; ++i) {
+            datagrams[i].data = gameState->receiveBuffers[i];
+            datagrams[i].length = MaxDatagramSize;
+        }
+        int32 readCount = UDPSocketReceiveBatch(&gameState->socket, datagrams, batchCount);
+        if(readCount <= 0) {
+            break;
+        }
+        receivedCount += readCount;
+
+        for(int32 i = 0; i < readCount; ++i) {
+            BitStream inStream;
+            if(!PacketOpen(datagrams[i].data, datagrams[i].length, &inStream)) {
+                continue;
+            }
+            int32 type = BitStreamReadInt(&inStream, 0, PACKET_TYPE_COUNT - 1);
+            if(type == PACKET_TYPE_STATE) {
+                ConnectionHeader connectionHeader;
+                ConnectionReadHeader(&inStream, &connectionHeader);
+                if(inStream.overflow || !ConnectionProcessHeader(&gameState->connection, &connectionHeader, gameState->totalGameTime)) {
+                    stats->staleCount++;
+                    continue;
+                }
+                gameState->timePassFromLastServerPacket = 0;
+                if(!ProcessStatePacket(gameState, &inStream)) {
+                    stats->staleCount++;
+                }
+            }
+        }
+    }
+
+    if(gameState->hasHeroState) {
+        ReconcilePlayer(gameState, &gameState->heroState, gameState->heroLastAppliedInput);
+        gameState->serverLastAppliedInput = gameState->heroLastAppliedInput;
+    }
+
+    stats->frameCount++;
+    stats->packetCount += receivedCount;
+    stats->maxPacketsPerFrame = Max(stats->maxPacketsPerFrame, receivedCount);
+    if(receivedCount == MaxPacketPerFrameCount) {
+        stats->budgetHitCount++;
+    }
+    if(gameState->totalGameTime - stats->lastReport >= ReceiveStatsReportInterval) {
+        printf("recived packets: %u frames: %u avg per frame: %.2f max per frame: %d budget hits: %u stale: %u\n",
+               stats->packetCount, stats->frameCount, stats->frameCount ? (float32)stats->packetCount / stats->frameCount : 0.0f,
+               stats->maxPacketsPerFrame, stats->budgetHitCount, stats->staleCount);
+        memset(stats, 0, sizeof(ReceiveStats));
+        stats->lastReport = gameState->totalGameTime;
+    }
+}
+
+// Forget everything we got from the server and go back to saying hello
+void ResetConnection(GameState *gameState) {
+    gameState->entities.Clear();
+    gameState->entity = 0;
+    gameState->networkToEntity.Clear();
+    SnapshotHistoryClear(gameState->snapshots);
+    ConnectionInitialize(&gameState->connection);
+    gameState->serverTick = 0;
+    gameState->inputSequence = 0;
+    gameState->serverLastAppliedInput = 0;
+    gameState->tickAccumulator = 0;
+    gameState->hasServerTime = false;
+    gameState->hasChallenge = false;
+    gameState->clientState = CLIENT_STATE_HELLO;
+    gameState->timePassFromLastInputPacket = TimeBetweenHellos;
+}
+
+// Hello until the server challenges us, then the response with its cookie. Both are
+// padded so the server answer is never bigger than what we send
+void SendConnectPacket(GameState *gameState) {
+    uint8 buffer[MinConnectPacketSize];
+    PacketType type = gameState->hasChallenge ? PACKET_TYPE_RESPONSE : PACKET_TYPE_HELLO;
+    int32 packetSize = WriteConnectPacket(buffer, type, gameState->challengeCookie);
+    int sentBytes = UDPSocketSendTo(&gameState->socket, buffer, packetSize, &gameState->sendAddress);
+    if (sentBytes != packetSize) {
+        printf( "failed to send %s packet\n", gameState->hasChallenge ? "Response" : "Hello" );
+    }
+    else {
+        printf( "%s Packet send\n", gameState->hasChallenge ? "Response" : "Hello" );
+    }
+}
+
+void SendKeepalive(GameState *gameState) {
+    char buffer[64];
+    int32 packetSize = WriteKeepalivePacket(buffer, 64, GetEntity(gameState, gameState->entity)->uid);
+    int sentBytes = UDPSocketSendTo(&gameState->socket, buffer, packetSize, &gameState->sendAddress);
+    if (sentBytes != packetSize) {
+        printf( "failed to send Keepalive packet\n" );
+    }
+}
+
+void GameUpdateAndRender(Memory *memory, GameSound *sound, GameInput *input, GameBackBuffer *backBuffer) {
+
+    GameState *gameState = (GameState *)memory->data;
+    float32 dt = input->deltaTime;
+    if(gameState->clientState == CLIENT_STATE_HELLO) {
+        char buffer[1200];
+        if(gameState->timePassFromLastInputPacket >= TimeBetweenHellos) {
+            SendConnectPacket(gameState);
+            gameState->timePassFromLastInputPacket -= TimeBetweenHellos;
         }
         gameState->timePassFromLastInputPacket += dt;
 
         // TODO: check for the welcome packe to arrive ...
         UDPAddress fromAddress;
         int32 bytes = UDPSocketReceiveFrom(&gameState->socket, buffer, 1200, &fromAddress);
-        if(bytes > 0) {
-            MemoryStream inStream = MemoryStreamCreate(buffer, 1200);            
-            int32 header;
-            MemoryStreamRead(&inStream, &header, sizeof(int32));
-            if(header == PacketHeader) {
-                int32 type;
-                MemoryStreamRead(&inStream, &type, sizeof(int32));
-                if(type == PacketTypeWelcome) {
-                    uint32 networkID;
-                    MemoryStreamRead(&inStream, &networkID, sizeof(uint32));
-                    gameState->entity = CreatePlayer(gameState);
-                    gameState->entity->uid = networkID;
-                    gameState->networkToEntity.Add(networkID, gameState->entity);
-                    gameState->clientState = CLIENT_STATE_WELCOMED;
+        BitStream inStream;
+        if(bytes > 0 && PacketOpen(buffer, bytes, &inStream)) {
+            int32 type = BitStreamReadInt(&inStream, 0, PACKET_TYPE_COUNT - 1);
+            if(type == PACKET_TYPE_CHALLENGE) {
+                uint32 cookie = BitStreamReadBits(&inStream, 32);
+                if(!inStream.overflow) {
+                    gameState->challengeCookie = cookie;
+                    gameState->hasChallenge = true;
+                    SendConnectPacket(gameState);
                     gameState->timePassFromLastInputPacket = 0;
-                    printf("Welcome Packet Recived\n");
-                    printf("Client conected to the server\n");
                 }
             }
+            else if(type == PACKET_TYPE_WELCOME) {
+                WelcomePacket welcome;
+                ReadWelcomePacket(&inStream, &welcome);
+                uint32 networkID = welcome.uid;
+                gameState->serverTick = welcome.tick;
+                gameState->serverTickRate = welcome.tickRate;
+                gameState->serverShardIndex = welcome.shardIndex;
+                gameState->tickDt = 1.0f / (float32)gameState->serverTickRate;
+                Entity *hero = CreatePlayer(gameState);
+                hero->uid = networkID;
+                gameState->entity = hero->handle;
+                gameState->networkToEntity.Add(networkID, hero->handle);
+                gameState->clientState = CLIENT_STATE_WELCOMED;
+                ConnectionInitialize(&gameState->connection);
+                gameState->timePassFromLastInputPacket = 0;
+                gameState->timePassFromLastServerPacket = 0;
+                printf("Welcome Packet Recived\n");
+                printf("Client conected to the server shard %d\n", gameState->serverShardIndex);
+            }
 
         }
     
     }
     else if(gameState->clientState == CLIENT_STATE_WELCOMED) {
 
-        bool sendPacketThisFrame = false;
-
         if(input->controllers[0].A.endedDown) {
             sound->Restart(gameState->missionCompleted);
             sound->Play(gameState->missionCompleted);
         }
 
-        Entity *hero = gameState->entity;
         float32 inputX = 0;
         float32 inputY = 0;
         if(input->controllers[0].left.endedDown) {
-            hero->vel.x -= 1;
             inputX -= 1;
-            sendPacketThisFrame = true;
         }
         if(input->controllers[0].right.endedDown) {
-            hero->vel.x += 1;
             inputX += 1;
-            sendPacketThisFrame = true;
         }
         if(input->controllers[0].up.endedDown) {
-            hero->vel.y -= 1;
             inputY -= 1;
-            sendPacketThisFrame = true;
         }
         if(input->controllers[0].down.endedDown) {
-            hero->vel.y += 1;
             inputY += 1;
-            sendPacketThisFrame = true;
         }
 
-        Normalize(&hero->vel);
-        hero->vel *= 0.075f * 60.0f * dt;
-
-        // Sample inputs states
-        {
-            if(gameState->timePassFromLastInputSampled >= TimeBetweenInputSamples) {
-               
-                gameState->inputSamples[2] = gameState->inputSamples[1];
-                gameState->inputSamples[1] = gameState->inputSamples[0];
-                
-                float32 deltaTime = gameState->lastTimeStamp >= 0.f ? gameState->totalGameTime - gameState->lastTimeStamp : 0.f;
-
-                gameState->inputSamples[0].inputX = inputX;
-                gameState->inputSamples[0].inputY = inputY;
-                gameState->inputSamples[0].vel = hero->vel;
-                gameState->inputSamples[0].deltaTime = deltaTime;
-                gameState->inputSamples[0].timeStamp = gameState->totalGameTime;
-                    
-                gameState->lastTimeStamp = gameState->totalGameTime;
-                
-                gameState->inputSamplesCount = MIN(3, gameState->inputSamplesCount + 1);
-                
-                gameState->timePassFromLastInputSampled -= TimeBetweenInputSamples;
+        char buffer[1200];
+        // Predict our player on the server tick and send every input as soon as we use it,
+        // the server applies them in the same order with the same step
+        gameState->tickAccumulator += dt;
+        int32 tickCount = 0;
+        while(gameState->tickAccumulator >= gameState->tickDt && tickCount < MaxPredictedTicksPerFrame) {
+            gameState->tickAccumulator -= gameState->tickDt;
+            ++tickCount;
+
+            uint32 sequence = ++gameState->inputSequence;
+            InputState *sample = gameState->inputs + (sequence % InputBufferSize);
+            sample->sequence = sequence;
+            sample->inputX = inputX;
+            sample->inputY = inputY;
+            sample->action = input->controllers[0].A.endedDown;
+            sample->deltaTime = gameState->tickDt;
+            sample->timeStamp = gameState->totalGameTime;
+
+            Entity *hero = GetEntity(gameState, gameState->entity);
+            SimulatePlayer(gameState, hero, inputX, inputY, gameState->tickDt);
+            sample->vel = hero->vel;
+
+            // the inputs the server hasn't applied go again with every packet in case the
+            // previous ones got lost, the window grows with the loss
+            int32 unackedCount = (int32)Min(sequence - gameState->serverLastAppliedInput, (uint32)MaxInputSampleCount);
+            int32 samplesCount = Min(InputRedundancy(gameState->connection.packetLoss), unackedCount);
+            BitStream outStream = BeginInputPacket(buffer, 1200, &gameState->connection, gameState->totalGameTime,
+                                                   hero->uid, gameState->serverTick, gameState->interpolationDelay,
+                                                   sequence, samplesCount);
+            for(int32 i = 0; i < samplesCount; ++i) {
+                InputState *previous = gameState->inputs + ((sequence - i) % InputBufferSize);
+                WriteInputSample(&outStream, previous->inputX, previous->inputY, previous->action);
+            }
+
+            int32 packetSize = PacketEnd(&outStream);
+            int sentBytes = UDPSocketSendTo(&gameState->socket, buffer, packetSize, &gameState->sendAddress);
+            if (sentBytes != packetSize) {
+                printf( "failed to send packet\n" );
             }
-            gameState->timePassFromLastInputSampled += dt;
+            gameState->timePassFromLastInputPacket = 0;
+        }
+        // if we fall too far behind drop the time instead of spiraling
+        if(tickCount == MaxPredictedTicksPerFrame) {
+            gameState->tickAccumulator = 0;
         }
 
+        gameState->timePassFromLastInputPacket += dt;
+        if(gameState->timePassFromLastInputPacket >= KeepaliveInterval) {
+            SendKeepalive(gameState);
+            gameState->timePassFromLastInputPacket = 0;
+        }
 
-        char buffer[1200];
-        // Send input Messages
-        {
-            if(gameState->timePassFromLastInputPacket >= TimeBetweenInputPackets) {
-                MemoryStream outStream = MemoryStreamCreate(buffer, 1200);
-                MemoryStreamWrite(&outStream, (void *)&PacketHeader, sizeof(int32));
-                MemoryStreamWrite(&outStream, (void *)&PacketTypeState, sizeof(int32));
-                MemoryStreamWrite(&outStream, (void *)&gameState->entity->uid, sizeof(uint32));
-                MemoryStreamWrite(&outStream, (void *)&gameState->inputSamplesCount, sizeof(int32));
-                MemoryStreamWrite(&outStream, (void *)&gameState->inputSamples[0], sizeof(InputState));
-                MemoryStreamWrite(&outStream, (void *)&gameState->inputSamples[1], sizeof(InputState));
-                MemoryStreamWrite(&outStream, (void *)&gameState->inputSamples[2], sizeof(InputState));
-
-                if(sendPacketThisFrame) {
-                    int sentBytes = UDPSocketSendTo(&gameState->socket, buffer, 1200, &gameState->sendAddress);
-                    if (sentBytes != 1200) {
-                        printf( "failed to send packet\n" );
-                    }
-
-                    printf( "Packet send\n" );
-                }
+        gameState->timePassFromLastServerPacket += dt;
+        ReceivePackets(gameState);
 
-                gameState->timePassFromLastInputPacket -= TimeBetweenInputPackets;
+        // remote entities are rendered interpolationDelay seconds behind the server
+        if(gameState->hasServerTime) {
+            float64 renderTime = gameState->totalGameTime + gameState->serverTimeOffset - gameState->interpolationDelay;
+            for(uint32 i = 0; i < gameState->entities.count; ++i) {
+                Entity *entity = gameState->entities.elements + i;
+                if(entity->handle != gameState->entity) {
+                    InterpolateEntity(entity, renderTime, gameState->tickDt);
+                }
             }
-            gameState->timePassFromLastInputPacket += dt;
         }
 
-        UDPAddress fromAddress;
-        int32 bytes = UDPSocketReceiveFrom(&gameState->socket, buffer, 1200, &fromAddress);
-        if(bytes > 0) {
-            MemoryStream inStream = MemoryStreamCreate(buffer, 1200);            
-
-            int32 entitiesToUpdateCount;
-            MemoryStreamRead(&inStream, & entitiesToUpdateCount, sizeof(int32));
-
-            for(int32 i = 0; i < entitiesToUpdateCount; ++i) {
-                int32 header;
-                MemoryStreamRead(&inStream, &header, sizeof(int32));
-                if(header == PacketHeader) {
-                    int32 type;
-                    MemoryStreamRead(&inStream, &type, sizeof(int32));
-                    if(type == PacketTypeState) {
-                        uint32 networkID;
-                        MemoryStreamRead(&inStream, &networkID, sizeof(uint32));
-                        Vec2 pos, vel;
-                        MemoryStreamRead(&inStream, &pos, sizeof(Vec2));
-                        MemoryStreamRead(&inStream, &vel, sizeof(Vec2));
-                        
-                        Entity *entity = gameState->networkToEntity.Get(networkID);
-                        if(entity) {
-                            entity->pos = pos;
-                            entity->vel = vel;
-                        }
-                        else {
-                            // TODO: add the new entity
-                            Entity *newEntity = CreatePlayer(gameState);
-                            newEntity->uid = networkID;
-                            newEntity->pos = pos;
-                            newEntity->vel = vel;
-                            gameState->networkToEntity.Add(networkID, newEntity);
-                            
-                        }
-                    }
-                }           
-            }
-
+        if(gameState->timePassFromLastServerPacket > ConnectionTimeout) {
+            printf("connection to the server timed out\n");
+            ResetConnection(gameState);
         }
     }
 
@@ -322,8 +574,8 @@ void GameUpdateAndRender(Memory *memory, GameSound *sound, GameInput *input, Gam
         }
    }
 
-    Entity *hero = gameState->entities;
-    while(hero) { 
+    for(uint32 i = 0; i < gameState->entities.count; ++i) {
+        Entity *hero = gameState->entities.elements + i;
 
         DrawRectTexture(backBuffer, 
                         hero->pos.x*MetersToPixels,
@@ -339,7 +591,6 @@ void GameUpdateAndRender(Memory *memory, GameSound *sound, GameInput *input, Gam
                       (centerY - hero->dim.y * 0.5f)*MetersToPixels,
                       hero->dim.x*MetersToPixels, hero->dim.y*MetersToPixels,
                       0xFFFFFF00);
-        hero = hero->next;
     }
     
     gameState->totalGameTime += dt;
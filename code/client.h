@@ -122,6 +122,13 @@ enum EntityType {
     ENTITY_TYPE_ENEMY 
 };
 
+// state of a remote entity at a point of the server timeline
+struct InterpolationSample {
+    float64 time;
+    Vec2 pos;
+    Vec2 vel;
+};
+
 struct Entity {
     uint32 uid;
     EntityType type;
@@ -132,14 +139,19 @@ struct Entity {
 
     Vec2 spriteDim;
 
-    Entity *next;
-    Entity *prev;
+    // remote entities are rendered a bit in the past, between the states we recived
+    InterpolationSample interpolationSamples[InterpolationBufferSize];
+    int32 interpolationSampleCount;
+
+    SlotHandle handle;
 };
 
 struct InputState {
+    uint32 sequence;
     Vec2 vel;
     float32 inputX;
     float32 inputY;
+    bool action;
     float32 deltaTime;
     float64 timeStamp;
 };  
@@ -148,7 +160,7 @@ struct PacketInput {
     uint32 header;
     uint32 type;
     int32 samplesCount;
-    InputState samples[3];
+    InputState samples[MaxInputSampleCount];
 };
 
 struct PacketState {
@@ -158,6 +170,16 @@ struct PacketState {
     Vec2 vel;
 };
 
+// how many datagrams we drain from the socket per frame, reported every few seconds
+struct ReceiveStats {
+    float64 lastReport;
+    uint32 frameCount;
+    uint32 packetCount;
+    int32 maxPacketsPerFrame;
+    uint32 budgetHitCount;
+    uint32 staleCount;
+};
+
 enum ClientState {
     CLIENT_STATE_HELLO,
     CLIENT_STATE_WELCOMED
@@ -165,7 +187,8 @@ enum ClientState {
 
 struct GameState {
 
-    Entity *entity;
+    // our player
+    SlotHandle entity;
 
     Arena networkArena;
     Arena assetsArena;
@@ -188,25 +211,57 @@ struct GameState {
     CollisionPacket frameCollisions[1024];
     int32 frameCollisionCount;
 
-    // TODO: change this to use a slotmap or something more cache friendly
-    MemoryPool entityPool;
-    Entity *entities;
-    HashMap<Entity *> networkToEntity;
+    SlotMap<Entity> entities;
+    uint32 nextEntityUID;
+    HashMap<SlotHandle> networkToEntity;
 
     float64 totalGameTime;
-    InputState inputSamples[3];
-    int32  inputSamplesCount;
-    float32 lastTimeStamp;
+
+    // inputs we predicted with indexed by sequence, the ones the server hasn't applied
+    // yet are replayed on top of every state it sends us
+    InputState inputs[InputBufferSize];
+    uint32 inputSequence;
+    // newest input the server told us it applied, older ones are not sent again
+    uint32 serverLastAppliedInput;
+    float32 tickDt;
+    float32 tickAccumulator;
+
+    // estimate of the server clock used to render the remote entities interpolationDelay
+    // seconds behind it, the delay grows with the jitter of the state packets
+    float64 serverTimeOffset;
+    float64 lastStateTime;
+    float32 stateInterval;
+    float32 stateJitter;
+    float32 interpolationDelay;
+    bool hasServerTime;
 
 
     UDPSocket socket;
     UDPAddress address;
 
+    // latest server tick we recived, it is sent back with every input packet
+    // and the server uses it as the baseline of the next snapshot delta
+    uint32 serverTick;
+    int32 serverTickRate;
+    int32 serverShardIndex;
+    SnapshotHistory *snapshots;
+    Connection connection;
+
+    uint8 receiveBuffers[MaxDatagramBatchCount][MaxDatagramSize];
+    ReceiveStats receiveStats;
+    // newest state of our player recived this frame
+    EntitySnapshot heroState;
+    uint32 heroLastAppliedInput;
+    bool hasHeroState;
+
     ClientState clientState;
     UDPAddress sendAddress;
+    // cookie the server sent us in the challenge, we echo it until the welcome arrives
+    uint32 challengeCookie;
+    bool hasChallenge;
 
-    float32 timePassFromLastInputSampled;
     float32 timePassFromLastInputPacket;
+    float32 timePassFromLastServerPacket;
 };
 
 #endif
@@ -217,16 +272,22 @@ static const float32 PixelsToMeters = 1.0f / MetersToPixels;
 static const int32 SPRITE_SIZE = 1;
 static const uint32 MaxEntityCount = 1024;
 
-static const uint32 PacketHeader      = 'PIPE';
-static const uint32 PacketTypeHello   = 'HELO';
-static const uint32 PacketTypeState   = 'STAT';
-static const uint32 PacketTypeWelcome = 'WLCM';
 
 static const float32 TimeBetweenHellos = 1.f;
 
-static const float32 TimeBetweenInputPackets = 0.033f;
-static const float32 TimeBetweenInputSamples = 0.03f;
+static const int32   MaxPredictedTicksPerFrame = 5;
+
+static const float32 ClockSmoothing = 0.05f;
+static const float32 StateJitterSmoothing = 1.0f / 16.0f;
+static const float32 InterpolationDelaySmoothing = 0.1f;
+// the delay covers one state interval plus this many times the jitter
+static const float32 InterpolationJitterScale = 2.0f;
+static const float32 MinInterpolationDelay = 0.05f;
+static const float32 MaxInterpolationDelay = 0.5f;
+// how far we move an entity past its newest state before waiting for the next one
+static const float32 MaxExtrapolationTime = 0.1f;
 
-static const uint32  MaxPacketPerFrameCount = 10;
+static const int32   MaxPacketPerFrameCount = 128;
+static const float64 ReceiveStatsReportInterval = 10.0;
 
 
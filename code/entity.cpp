@@ -1,22 +1,9 @@
+// The entity is zeroed. The pointer is only good until an entity is removed, keep its handle
 Entity *CreateEntity(GameState *gameState) {
-
-    static uint32 EntityUID = 0;
-
-    Entity *entity = (Entity *)MemoryPoolAlloc(&gameState->entityPool);
-    entity->uid = EntityUID++;
-
-    if(gameState->entities == nullptr) {
-        entity->next = nullptr;
-        entity->prev = nullptr;
-        gameState->entities = entity;
-    }
-    else {
-        entity->prev = nullptr;
-        entity->next = gameState->entities;
-        entity->next->prev = entity;
-        
-        gameState->entities = entity;
-    }
+    SlotHandle handle = gameState->entities.Add();
+    Entity *entity = gameState->entities.Get(handle);
+    entity->handle = handle;
+    entity->uid = gameState->nextEntityUID++;
     return entity;
 }
 
@@ -30,20 +17,23 @@ Entity *CreatePlayer(GameState *gameState) {
     return entity;
 }
 
-void RemoveEntity(GameState *gameState, Entity *entity) {
-    // remove it from the free list
-    if(entity->prev != nullptr) {
-        entity->prev->next = entity->next;
-    }
-    if(entity->next != nullptr) {
-        entity->next->prev = entity->prev;
-    }
-    // free the memory block
-    MemoryPoolRelease(&gameState->entityPool, entity); 
+// nullptr if the entity was removed
+Entity *GetEntity(GameState *gameState, SlotHandle handle) {
+    return gameState->entities.Get(handle);
+}
+
+// The last entity moves in its place, pointers to entities are not good after this
+void RemoveEntity(GameState *gameState, SlotHandle handle) {
+    gameState->entities.Remove(handle);
+}
+
+// slot of the entity, it doesn't change while the entity lives
+int32 GetEntityIndex(GameState *gameState, Entity *entity) {
+    return (int32)gameState->entities.Index(entity->handle);
 }
 
 uint32 GetEntityCount(GameState *gameState) {
-    return gameState->entityPool.elementUsed;
+    return gameState->entities.count;
 }
 
 void MoveEntity(GameState *gameState, Entity *entity, float32 inputX, float32 inputY, float32 dt) {
@@ -128,20 +118,20 @@ void MoveEntity(GameState *gameState, Entity *entity, float32 inputX, float32 in
     else if(inputX != 0.0f) {
         if(sensor.mHit == false) {
             if(sensor.lHit) {
-                centerY += 1.0f * 0.075f * 60.0f * dt;
+                centerY += PlayerSpeed * dt;
             }
             if(sensor.rHit) { 
-                centerY -= 1.0f * 0.075f * 60.0f * dt;
+                centerY -= PlayerSpeed * dt;
             }
         }
     }
     else if(inputY != 0.0f) {
         if(sensor.mHit == false) {
             if(sensor.lHit) {
-                centerX += 1.0f * 0.075f * 60.0f * dt;
+                centerX += PlayerSpeed * dt;
             }
             if(sensor.rHit) { 
-                centerX -= 1.0f * 0.075f * 60.0f * dt;
+                centerX -= PlayerSpeed * dt;
             }
         }
     }
@@ -156,3 +146,20 @@ void MoveEntity(GameState *gameState, Entity *entity, float32 inputX, float32 in
     // Clear forces for next frame
     entity->vel = Vec2();
 }
+
+// One simulation step of a player driven by its input, the server runs it every tick and
+// the client runs the same steps to predict its own player
+void SimulatePlayer(GameState *gameState, Entity *entity, float32 inputX, float32 inputY, float32 dt) {
+    if(inputX == 0.0f && inputY == 0.0f) {
+        entity->vel = Vec2(0, 0);
+        return;
+    }
+    // the velocity is computed from the input direction on the fixed step
+    Vec2 dir = Normalized(Vec2(inputX, inputY));
+    entity->vel = dir * PlayerSpeed * dt;
+    Vec2 start = entity->pos;
+    MoveEntity(gameState, entity, inputX, inputY, dt);
+    // MoveEntity clears the velocity, keep what the step really moved after the
+    // collisions so the snapshots carry it and the client can extrapolate with it
+    entity->vel = entity->pos - start;
+}
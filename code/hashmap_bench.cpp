@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "common.h"
+#include "algebra.h"
+#include "memory.h"
+
+#include "memory.cpp"
+
+// Microbenchmark of HashMap against the linear probing map with tombstones it replaced,
+// at 50, 75 and 90% load. Churn removes a random key and adds a new one to see what
+// happens to the lookups of a map that lives for a long time like clientsMap
+
+// The map before Robin Hood: linear probing, tombstones on remove and lookups bounded
+// by the longest probe any insert ever made
+template <typename Type>
+struct LinearHashMap {
+    struct HashElement {
+        uint32 hash;
+        uint64 key;
+        Type value;
+    };
+
+    uint32 occupied;
+    uint32 capacity;
+    uint32 mask;
+    uint32 maxProbe;
+    HashElement *elements;
+
+    void Initialize(Arena *arena, uint32 size) {
+        capacity = size;
+        mask = size - 1;
+        occupied = 0;
+        maxProbe = 0;
+        elements = (HashElement *)ArenaPushSize(arena, sizeof(HashElement) * capacity);
+        memset(elements, 0, sizeof(HashElement) * capacity);
+    }
+
+    uint32 Hash(uint64 key) {
+        uint32 hash = MurMur2(&key, sizeof(uint64), 123);
+        return (hash == 0 || hash == 0xFFFFFFFF) ? 1 : hash;
+    }
+
+    bool Occupied(uint32 index) {
+        return elements[index].hash != 0 && elements[index].hash != 0xFFFFFFFF;
+    }
+
+    int32 Find(uint64 key, uint32 hash) {
+        uint32 index = hash & mask;
+        for(uint32 distance = 0; distance <= maxProbe; ++distance) {
+            if(elements[index].hash == 0) {
+                return -1;
+            }
+            if(elements[index].hash == hash && elements[index].key == key) {
+                return (int32)index;
+            }
+            index = (index + 1) & mask;
+        }
+        return -1;
+    }
+
+    void Add(uint64 key, Type value) {
+        uint32 hash = Hash(key);
+        int32 found = Find(key, hash);
+        if(found >= 0) {
+            elements[found].value = value;
+            return;
+        }
+        uint32 index = hash & mask;
+        uint32 distance = 0;
+        while(Occupied(index)) {
+            index = (index + 1) & mask;
+            ++distance;
+        }
+        elements[index].hash = hash;
+        elements[index].key = key;
+        elements[index].value = value;
+        occupied++;
+        maxProbe = Max(maxProbe, distance);
+    }
+
+    Type *GetPtr(uint64 key) {
+        int32 found = Find(key, Hash(key));
+        return found >= 0 ? &elements[found].value : nullptr;
+    }
+
+    void Remove(uint64 key) {
+        int32 found = Find(key, Hash(key));
+        if(found >= 0) {
+            elements[found].hash = 0xFFFFFFFF;
+            occupied--;
+        }
+    }
+};
+
+static const uint32 BenchCapacity = 1 << 16;
+static const int32  BenchLookupCount = 1 << 21;
+static const int32  BenchChurnCount = 1 << 20;
+
+static uint64 BenchRandomState = 0x9E3779B97F4A7C15ULL;
+
+uint64 BenchRandom() {
+    BenchRandomState ^= BenchRandomState << 13;
+    BenchRandomState ^= BenchRandomState >> 7;
+    BenchRandomState ^= BenchRandomState << 17;
+    return BenchRandomState;
+}
+
+typedef std::chrono::high_resolution_clock::time_point TimePoint;
+
+float64 NanosecondsPerOp(TimePoint start, TimePoint end, int32 count) {
+    return (float64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (float64)count;
+}
+
+struct BenchResult {
+    float64 insert;
+    float64 hit;
+    float64 miss;
+    float64 churn;
+    float64 hitAfterChurn;
+    uint32 maxProbe;
+    // keeps the compiler from dropping the lookups
+    uint64 checksum;
+};
+
+template <typename Type>
+uint32 MaxProbe(LinearHashMap<Type> *map) {
+    return map->maxProbe;
+}
+
+template <typename Type>
+uint32 MaxProbe(HashMap<Type> *map) {
+    return map->table.maxProbe;
+}
+
+// keys holds count live keys, the churn replaces them in place with new ones
+template <typename Map>
+BenchResult Bench(Map *map, uint64 *keys, int32 count, uint64 *missKeys) {
+    BenchResult result;
+    memset(&result, 0, sizeof(BenchResult));
+
+    TimePoint start = std::chrono::high_resolution_clock::now();
+    for(int32 i = 0; i < count; ++i) {
+        map->Add(keys[i], (uint32)i);
+    }
+    TimePoint end = std::chrono::high_resolution_clock::now();
+    result.insert = NanosecondsPerOp(start, end, count);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int32 i = 0; i < BenchLookupCount; ++i) {
+        uint32 *value = map->GetPtr(keys[((uint32)i * 7919u) % (uint32)count]);
+        result.checksum += value ? *value : 0;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.hit = NanosecondsPerOp(start, end, BenchLookupCount);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int32 i = 0; i < BenchLookupCount; ++i) {
+        uint32 *value = map->GetPtr(missKeys[i & (BenchCapacity - 1)]);
+        result.checksum += value ? *value : 0;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.miss = NanosecondsPerOp(start, end, BenchLookupCount);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int32 i = 0; i < BenchChurnCount; ++i) {
+        int32 slot = (int32)((i * 104729ULL) % count);
+        map->Remove(keys[slot]);
+        keys[slot] = BenchRandom() | 1;
+        map->Add(keys[slot], (uint32)slot);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.churn = NanosecondsPerOp(start, end, BenchChurnCount);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int32 i = 0; i < BenchLookupCount; ++i) {
+        uint32 *value = map->GetPtr(keys[((uint32)i * 7919u) % (uint32)count]);
+        result.checksum += value ? *value : 0;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    result.hitAfterChurn = NanosecondsPerOp(start, end, BenchLookupCount);
+
+    result.maxProbe = MaxProbe(map);
+    return result;
+}
+
+void PrintResult(const char *name, float32 load, BenchResult *result) {
+    printf("%-11s %3.0f%% %8.1f %8.1f %8.1f %8.1f %10.1f %9u\n", name, load * 100.0f, result->insert, result->hit,
+           result->miss, result->churn, result->hitAfterChurn, result->maxProbe);
+}
+
+int main() {
+    Memory memory;
+    memory.size = MB(64);
+    memory.used = 0;
+    memory.data = (uint8 *)malloc(memory.size);
+    Arena arena = ArenaCreate(&memory, memory.size);
+
+    uint64 *keys = ArenaPushArray(&arena, BenchCapacity, uint64);
+    uint64 *baseKeys = ArenaPushArray(&arena, BenchCapacity, uint64);
+    uint64 *missKeys = ArenaPushArray(&arena, BenchCapacity, uint64);
+    // the live keys are odd and the missing ones even so they never match
+    for(uint32 i = 0; i < BenchCapacity; ++i) {
+        baseKeys[i] = BenchRandom() | 1;
+        missKeys[i] = BenchRandom() & ~1ULL;
+    }
+
+    printf("capacity %u, ns per operation\n", BenchCapacity);
+    printf("map         load   insert      hit     miss    churn  hit churn  max probe\n");
+    float32 loads[] = { 0.5f, 0.75f, 0.9f };
+    uint64 checksum = 0;
+    for(int32 i = 0; i < (int32)ARRAY_LENGTH(loads); ++i) {
+        int32 count = (int32)(loads[i] * BenchCapacity);
+
+        ArenaTemp temp = ArenaTempBegin(&arena);
+        LinearHashMap<uint32> linear;
+        linear.Initialize(&arena, BenchCapacity);
+        memcpy(keys, baseKeys, sizeof(uint64) * count);
+        BenchResult linearResult = Bench(&linear, keys, count, missKeys);
+        PrintResult("linear", loads[i], &linearResult);
+        ArenaTempEnd(temp);
+
+        temp = ArenaTempBegin(&arena);
+        HashMap<uint32> robinHood;
+        robinHood.Initialize(&arena, BenchCapacity);
+        memcpy(keys, baseKeys, sizeof(uint64) * count);
+        BenchResult robinHoodResult = Bench(&robinHood, keys, count, missKeys);
+        PrintResult("robin hood", loads[i], &robinHoodResult);
+        ArenaTempEnd(temp);
+
+        checksum += linearResult.checksum + robinHoodResult.checksum;
+    }
+    printf("checksum %llu\n", (unsigned long long)checksum);
+
+    free(memory.data);
+    return 0;
+}
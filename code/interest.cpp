@@ -0,0 +1,97 @@
+//
+//  interest.cpp
+//
+//  Area of interest for the state broadcast. The world entities are bucketed in a
+//  uniform grid over the tilemap every snapshot, and each client only gets the
+//  entities around its own player.
+//
+
+void InterestGridInitialize(InterestGrid *grid, Arena *arena, int32 tilesCountX, int32 tilesCountY, float32 cellSize) {
+    grid->cellSize = cellSize;
+    grid->invCellSize = 1.0f / cellSize;
+    grid->cellCountX = Max(1, (int32)ceilf((float32)tilesCountX / cellSize));
+    grid->cellCountY = Max(1, (int32)ceilf((float32)tilesCountY / cellSize));
+    int32 cellCount = grid->cellCountX * grid->cellCountY;
+    grid->cellStart = ArenaPushArray(arena, cellCount + 1, int32);
+    grid->cellCursor = ArenaPushArray(arena, cellCount, int32);
+    grid->entityCells = ArenaPushArray(arena, MaxEntityCount, int32);
+    grid->entityIndices = ArenaPushArray(arena, MaxEntityCount, int32);
+    grid->entityCount = 0;
+}
+
+static int32 InterestGridCellX(InterestGrid *grid, float32 x) {
+    int32 cellX = (int32)floorf(x * grid->invCellSize);
+    return Min(Max(cellX, 0), grid->cellCountX - 1);
+}
+
+static int32 InterestGridCellY(InterestGrid *grid, float32 y) {
+    int32 cellY = (int32)floorf(y * grid->invCellSize);
+    return Min(Max(cellY, 0), grid->cellCountY - 1);
+}
+
+// Bucket the entities by cell with a counting sort, after this the entities of a
+// cell are entityIndices[cellStart[cell]] to entityIndices[cellStart[cell + 1] - 1]
+void InterestGridBuild(InterestGrid *grid, EntitySnapshot *entities, int32 entityCount) {
+    int32 cellCount = grid->cellCountX * grid->cellCountY;
+    memset(grid->cellStart, 0, sizeof(int32) * (cellCount + 1));
+
+    for(int32 i = 0; i < entityCount; ++i) {
+        int32 cell = InterestGridCellY(grid, entities[i].pos.y) * grid->cellCountX +
+                     InterestGridCellX(grid, entities[i].pos.x);
+        grid->entityCells[i] = cell;
+        grid->cellStart[cell + 1]++;
+    }
+    for(int32 i = 0; i < cellCount; ++i) {
+        grid->cellStart[i + 1] += grid->cellStart[i];
+    }
+    memcpy(grid->cellCursor, grid->cellStart, sizeof(int32) * cellCount);
+    for(int32 i = 0; i < entityCount; ++i) {
+        grid->entityIndices[grid->cellCursor[grid->entityCells[i]]++] = i;
+    }
+    grid->entityCount = entityCount;
+}
+
+// Fill outIndices with the index of the entities within radius of the owner and return
+// the count. Entities that were already in previous stay until they are further than
+// leaveRadius, so the ones on the border don't enter and leave every snapshot. The
+// owner is always the first
+int32 InterestGather(InterestGrid *grid, EntitySnapshot *entities, int32 ownerIndex, float32 radius,
+                     float32 leaveRadius, Snapshot *previous, int32 *outIndices, int32 maxCount) {
+    int32 count = 0;
+    outIndices[count++] = ownerIndex;
+
+    Vec2 center = entities[ownerIndex].pos;
+
+    int32 minX = InterestGridCellX(grid, center.x - leaveRadius);
+    int32 maxX = InterestGridCellX(grid, center.x + leaveRadius);
+    int32 minY = InterestGridCellY(grid, center.y - leaveRadius);
+    int32 maxY = InterestGridCellY(grid, center.y + leaveRadius);
+
+    float32 radiusSq = radius * radius;
+    float32 leaveRadiusSq = leaveRadius * leaveRadius;
+
+    for(int32 y = minY; y <= maxY; ++y) {
+        for(int32 x = minX; x <= maxX; ++x) {
+            int32 cell = y * grid->cellCountX + x;
+            for(int32 i = grid->cellStart[cell]; i < grid->cellStart[cell + 1]; ++i) {
+                int32 index = grid->entityIndices[i];
+                if(index == ownerIndex) {
+                    continue;
+                }
+                EntitySnapshot *entity = entities + index;
+                float32 distanceSq = LenSq(entity->pos - center);
+                if(distanceSq > leaveRadiusSq) {
+                    continue;
+                }
+                if(distanceSq > radiusSq && (previous == nullptr || SnapshotFind(previous, entity->uid) == nullptr)) {
+                    continue;
+                }
+                if(count == maxCount) {
+                    return count;
+                }
+                outIndices[count++] = index;
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,176 @@
+//
+//  journal.cpp
+//
+//  Record and replay of the server input. Recording writes the dt of every update
+//  and the datagrams it received, replaying feeds them back through ServerUpdate in
+//  the same order with a null socket. The simulation only depends on them, so a
+//  replay ends in the same state as the recorded session and runs as fast as the
+//  server can update.
+//
+
+void JournalHeaderFromConfig(JournalHeader *header, ServerConfig *config) {
+    memset(header, 0, sizeof(JournalHeader));
+    header->magic = JournalMagic;
+    header->version = JournalVersion;
+    header->tickRate = config->tickRate;
+    header->snapshotRate = config->snapshotRate;
+    header->interestRadius = config->interestRadius;
+    header->clientBandwidth = config->clientBandwidth;
+    // the cookies of the recorded handshakes only check with the same secret
+    header->challengeSecret = config->challengeSecret;
+    header->maxClients = config->maxClients;
+}
+
+bool JournalOpenRecord(Journal *journal, const char *path, ServerConfig *config) {
+    memset(journal, 0, sizeof(Journal));
+    journal->file = fopen(path, "wb");
+    if(journal->file == nullptr) {
+        printf("failed to open journal %s\n", path);
+        return false;
+    }
+    setvbuf(journal->file, nullptr, _IOFBF, JournalBufferSize);
+    JournalHeader header;
+    JournalHeaderFromConfig(&header, config);
+    fwrite(&header, sizeof(JournalHeader), 1, journal->file);
+    return true;
+}
+
+// Read the header of a journal into the config so the replay runs with the recorded settings
+bool JournalReadConfig(const char *path, ServerConfig *config) {
+    FILE *file = fopen(path, "rb");
+    if(file == nullptr) {
+        printf("failed to open journal %s\n", path);
+        return false;
+    }
+    JournalHeader header;
+    bool valid = fread(&header, sizeof(JournalHeader), 1, file) == 1 &&
+                 header.magic == JournalMagic && header.version == JournalVersion;
+    fclose(file);
+    if(!valid) {
+        printf("%s is not a journal\n", path);
+        return false;
+    }
+    config->tickRate = header.tickRate;
+    config->snapshotRate = header.snapshotRate;
+    config->interestRadius = header.interestRadius;
+    config->clientBandwidth = header.clientBandwidth;
+    config->challengeSecret = header.challengeSecret;
+    config->maxClients = header.maxClients;
+    return true;
+}
+
+bool JournalOpenReplay(Journal *journal, const char *path) {
+    memset(journal, 0, sizeof(Journal));
+    journal->file = fopen(path, "rb");
+    if(journal->file == nullptr) {
+        printf("failed to open journal %s\n", path);
+        return false;
+    }
+    setvbuf(journal->file, nullptr, _IOFBF, JournalBufferSize);
+    JournalHeader header;
+    if(fread(&header, sizeof(JournalHeader), 1, journal->file) != 1) {
+        fclose(journal->file);
+        journal->file = nullptr;
+        return false;
+    }
+    journal->replaying = true;
+    return true;
+}
+
+void JournalClose(Journal *journal) {
+    if(journal->file) {
+        fclose(journal->file);
+        journal->file = nullptr;
+    }
+}
+
+void JournalWriteUpdate(Journal *journal, uint64 dt, uint32 tick) {
+    uint8 type = JOURNAL_RECORD_UPDATE;
+    fwrite(&type, sizeof(uint8), 1, journal->file);
+    fwrite(&dt, sizeof(uint64), 1, journal->file);
+    fwrite(&tick, sizeof(uint32), 1, journal->file);
+    journal->updateCount++;
+}
+
+void JournalWriteDatagram(Journal *journal, UDPDatagram *datagram) {
+    uint8 type = JOURNAL_RECORD_DATAGRAM;
+    uint32 ip = UDPAddressIP(&datagram->address);
+    uint16 port = UDPAddressPort(&datagram->address);
+    uint16 length = (uint16)datagram->length;
+    fwrite(&type, sizeof(uint8), 1, journal->file);
+    fwrite(&ip, sizeof(uint32), 1, journal->file);
+    fwrite(&port, sizeof(uint16), 1, journal->file);
+    fwrite(&length, sizeof(uint16), 1, journal->file);
+    fwrite(datagram->data, length, 1, journal->file);
+    journal->datagramCount++;
+}
+
+// Read the next record, returns the type or 0 at the end of the journal
+int32 JournalReadRecord(Journal *journal, UDPDatagram *datagram) {
+    uint8 type;
+    if(fread(&type, sizeof(uint8), 1, journal->file) != 1) {
+        return 0;
+    }
+    if(type == JOURNAL_RECORD_UPDATE) {
+        if(fread(&journal->pendingDt, sizeof(uint64), 1, journal->file) != 1 ||
+           fread(&journal->pendingTick, sizeof(uint32), 1, journal->file) != 1) {
+            return 0;
+        }
+        journal->hasPendingUpdate = true;
+        return type;
+    }
+    if(type == JOURNAL_RECORD_DATAGRAM) {
+        uint32 ip;
+        uint16 port;
+        uint16 length;
+        if(fread(&ip, sizeof(uint32), 1, journal->file) != 1 ||
+           fread(&port, sizeof(uint16), 1, journal->file) != 1 ||
+           fread(&length, sizeof(uint16), 1, journal->file) != 1 ||
+           length > datagram->length || fread(datagram->data, length, 1, journal->file) != 1) {
+            return 0;
+        }
+        datagram->address = UDPAddresCreate(ip, port);
+        datagram->length = length;
+        return type;
+    }
+    printf("bad journal record %d\n", type);
+    return 0;
+}
+
+// Start the next recorded update, returns false at the end of the journal
+bool JournalReadUpdate(Journal *journal, uint32 tick, uint64 *outDt) {
+    if(!journal->hasPendingUpdate) {
+        UDPDatagram datagram;
+        uint8 buffer[MaxDatagramSize];
+        datagram.data = buffer;
+        datagram.length = MaxDatagramSize;
+        // skip datagrams left from an update that stopped reading before taking all of them
+        int32 type;
+        while((type = JournalReadRecord(journal, &datagram)) == JOURNAL_RECORD_DATAGRAM) {
+        }
+        if(type == 0) {
+            return false;
+        }
+    }
+    journal->hasPendingUpdate = false;
+    if(journal->pendingTick != tick) {
+        journal->mismatchCount++;
+    }
+    journal->updateCount++;
+    *outDt = journal->pendingDt;
+    return true;
+}
+
+// Same as UDPSocketReceiveBatch, returns the datagrams the current update received.
+// The datagrams need the buffer and its size set like for the socket
+int32 JournalReadDatagrams(Journal *journal, UDPDatagram *datagrams, int32 count) {
+    int32 readCount = 0;
+    while(readCount < count && !journal->hasPendingUpdate) {
+        if(JournalReadRecord(journal, datagrams + readCount) != JOURNAL_RECORD_DATAGRAM) {
+            break;
+        }
+        journal->datagramCount++;
+        ++readCount;
+    }
+    return readCount;
+}
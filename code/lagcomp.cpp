@@ -0,0 +1,125 @@
+//
+//  lagcomp.cpp
+//
+//  Lag compensation. The server keeps the position of every entity for the last
+//  MaxLagCompensation seconds of ticks so the actions of a client can be checked
+//  against the world it was looking at when it acted, not the current one.
+//
+
+void LagHistoryInitialize(LagHistory *history, Arena *arena, int32 frameCount, int32 slotCount) {
+    history->frameCount = frameCount;
+    history->slotCount = slotCount;
+    history->newestTick = 0;
+    history->ticks = ArenaPushArray(arena, frameCount, uint32);
+    history->uids = ArenaPushArray(arena, frameCount * slotCount, uint32);
+    history->posX = ArenaPushArray(arena, frameCount * slotCount, float32);
+    history->posY = ArenaPushArray(arena, frameCount * slotCount, float32);
+    memset(history->ticks, 0, sizeof(uint32) * frameCount);
+    memset(history->uids, 0, sizeof(uint32) * frameCount * slotCount);
+    history->rewindUids = ArenaPushArray(arena, slotCount, uint32);
+    history->rewindX = ArenaPushArray(arena, slotCount, float32);
+    history->rewindY = ArenaPushArray(arena, slotCount, float32);
+}
+
+// Store the positions of the entities for the current tick over the oldest frame
+void LagHistoryRecord(LagHistory *history, GameState *gameState) {
+    int32 frame = (int32)(gameState->tick % (uint32)history->frameCount);
+    uint32 *uids = history->uids + frame * history->slotCount;
+    float32 *posX = history->posX + frame * history->slotCount;
+    float32 *posY = history->posY + frame * history->slotCount;
+    memset(uids, 0, sizeof(uint32) * history->slotCount);
+    for(uint32 i = 0; i < gameState->entities.count; ++i) {
+        Entity *entity = gameState->entities.elements + i;
+        int32 slot = GetEntityIndex(gameState, entity);
+        uids[slot] = entity->uid;
+        posX[slot] = entity->pos.x;
+        posY[slot] = entity->pos.y;
+    }
+    history->ticks[frame] = gameState->tick;
+    history->newestTick = gameState->tick;
+}
+
+// Frame of a tick if we still have it, -1 otherwise
+int32 LagHistoryFrame(LagHistory *history, uint32 tick) {
+    int32 frame = (int32)(tick % (uint32)history->frameCount);
+    if(tick == 0 || history->ticks[frame] != tick) {
+        return -1;
+    }
+    return frame;
+}
+
+// Clamp a fractional tick to the ticks we have, split in the tick before it and
+// the fraction towards the next one
+float64 LagHistoryClampTick(LagHistory *history, float64 viewTick) {
+    float64 newest = (float64)history->newestTick;
+    float64 oldest = Max(newest - (float64)(history->frameCount - 1), 1.0);
+    return Min(Max(viewTick, oldest), newest);
+}
+
+// Rebuild the whole world at a fractional tick in slot order. The out arrays need
+// slotCount entries, the slots without an entity get uid 0. Returns the slot count
+int32 LagHistoryRewind(LagHistory *history, float64 viewTick, uint32 *outUids, float32 *outPosX, float32 *outPosY) {
+    viewTick = LagHistoryClampTick(history, viewTick);
+    uint32 tick = (uint32)viewTick;
+    float32 t = (float32)(viewTick - (float64)tick);
+
+    int32 from = LagHistoryFrame(history, tick);
+    if(from < 0) {
+        memset(outUids, 0, sizeof(uint32) * history->slotCount);
+        return history->slotCount;
+    }
+    uint32 *fromUids = history->uids + from * history->slotCount;
+    float32 *fromX = history->posX + from * history->slotCount;
+    float32 *fromY = history->posY + from * history->slotCount;
+    memcpy(outUids, fromUids, sizeof(uint32) * history->slotCount);
+    memcpy(outPosX, fromX, sizeof(float32) * history->slotCount);
+    memcpy(outPosY, fromY, sizeof(float32) * history->slotCount);
+
+    int32 to = LagHistoryFrame(history, tick + 1);
+    if(t > 0.0f && to >= 0) {
+        uint32 *toUids = history->uids + to * history->slotCount;
+        float32 *toX = history->posX + to * history->slotCount;
+        float32 *toY = history->posY + to * history->slotCount;
+        for(int32 i = 0; i < history->slotCount; ++i) {
+            // a slot can be reused by another entity between the two ticks
+            float32 blend = (outUids[i] != 0 && toUids[i] == outUids[i]) ? t : 0.0f;
+            outPosX[i] += (toX[i] - outPosX[i]) * blend;
+            outPosY[i] += (toY[i] - outPosY[i]) * blend;
+        }
+    }
+    return history->slotCount;
+}
+
+// The tick the client was rendering when it sent its last input. The input needs half
+// the rtt to get here and the state it was looking at needed the other half to get
+// there, plus the time the client holds states back to interpolate between them
+float64 ServerClientViewTick(GameState *gameState, Client *client) {
+    float32 behind = client->connection.rtt + client->interpolationDelay;
+    behind = Min(behind, MaxLagCompensation);
+    return (float64)gameState->tick - (float64)(behind / gameState->tickDt);
+}
+
+// Judge the action of a client against the world it was looking at: every other entity
+// within InteractRange of its player at the tick it was rendering. Its own player is
+// where the input that pressed the action put it. Returns how many entities it reached
+int32 ServerClientInteract(GameState *gameState, Client *client, Entity *entity) {
+    LagHistory *history = &gameState->lagHistory;
+    float64 viewTick = ServerClientViewTick(gameState, client);
+    int32 slotCount = LagHistoryRewind(history, viewTick, history->rewindUids, history->rewindX, history->rewindY);
+
+    float32 rangeSq = InteractRange * InteractRange;
+    int32 reachedCount = 0;
+    for(int32 i = 0; i < slotCount; ++i) {
+        uint32 uid = history->rewindUids[i];
+        if(uid == 0 || uid == entity->uid) {
+            continue;
+        }
+        float32 dx = history->rewindX[i] - entity->pos.x;
+        float32 dy = history->rewindY[i] - entity->pos.y;
+        if(dx * dx + dy * dy <= rangeSq) {
+            ++reachedCount;
+        }
+    }
+    ProfilerCountAction(&gameState->profiler, reachedCount);
+    return reachedCount;
+}
@@ -21,6 +21,8 @@
 #include "algebra.h"
 #include "memory.h"
 #include "network.h"
+#include "protocol.h"
+#include "snapshot.h"
 #include "client.h"
 
 #include "mac_renderer.cpp"
@@ -29,6 +31,8 @@
 
 #include "memory.cpp"
 #include "network.cpp"
+#include "protocol.cpp"
+#include "snapshot.cpp"
 #include "wave_file.cpp"
 #include "collision.cpp"
 #include "tilemap.cpp"
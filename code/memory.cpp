@@ -108,6 +108,172 @@ void MemoryStreamReset(MemoryStream *stream) {
     stream->current = stream->head;
 }
 
+// BitStream implementation
+
+BitStream BitStreamCreate(void *buffer, size_t bufferSize) {
+    BitStream stream;
+    stream.buffer = (uint8 *)buffer;
+    stream.size = bufferSize;
+    stream.bitPosition = 0;
+    stream.overflow = false;
+    return stream;
+}
+
+size_t BitStreamBytesUsed(BitStream *stream) {
+    return (stream->bitPosition + 7) / 8;
+}
+
+size_t BitStreamBitsLeft(BitStream *stream) {
+    return stream->size * 8 - stream->bitPosition;
+}
+
+int32 BitsRequired(uint32 range) {
+    int32 bits = 0;
+    while(range) {
+        ++bits;
+        range >>= 1;
+    }
+    return Max(bits, 1);
+}
+
+void BitStreamWriteBits(BitStream *stream, uint32 value, int32 bitCount) {
+    ASSERT(bitCount > 0 && bitCount <= 32);
+    ASSERT(stream->bitPosition + bitCount <= stream->size * 8);
+    if(bitCount < 32) {
+        value &= (1u << bitCount) - 1;
+    }
+    while(bitCount > 0) {
+        uint8 *byte = stream->buffer + (stream->bitPosition >> 3);
+        int32 bitOffset = stream->bitPosition & 7;
+        int32 bitsInByte = Min(8 - bitOffset, bitCount);
+        uint32 mask = (1u << bitsInByte) - 1;
+        if(bitOffset == 0) {
+            *byte = 0;
+        }
+        *byte |= (uint8)((value & mask) << bitOffset);
+        value >>= bitsInByte;
+        bitCount -= bitsInByte;
+        stream->bitPosition += bitsInByte;
+    }
+}
+
+// Write zeros until the stream uses byteCount bytes
+void BitStreamWritePadding(BitStream *stream, size_t byteCount) {
+    ASSERT(byteCount <= stream->size);
+    while(stream->bitPosition < byteCount * 8) {
+        int32 bitCount = (int32)Min(byteCount * 8 - stream->bitPosition, (size_t)32);
+        BitStreamWriteBits(stream, 0, bitCount);
+    }
+}
+
+uint32 BitStreamReadBits(BitStream *stream, int32 bitCount) {
+    ASSERT(bitCount > 0 && bitCount <= 32);
+    if(stream->overflow || stream->bitPosition + bitCount > stream->size * 8) {
+        stream->overflow = true;
+        return 0;
+    }
+    uint32 value = 0;
+    int32 shift = 0;
+    while(bitCount > 0) {
+        uint8 byte = stream->buffer[stream->bitPosition >> 3];
+        int32 bitOffset = stream->bitPosition & 7;
+        int32 bitsInByte = Min(8 - bitOffset, bitCount);
+        uint32 mask = (1u << bitsInByte) - 1;
+        value |= ((byte >> bitOffset) & mask) << shift;
+        shift += bitsInByte;
+        bitCount -= bitsInByte;
+        stream->bitPosition += bitsInByte;
+    }
+    return value;
+}
+
+void BitStreamWriteBool(BitStream *stream, bool value) {
+    BitStreamWriteBits(stream, value ? 1 : 0, 1);
+}
+
+bool BitStreamReadBool(BitStream *stream) {
+    return BitStreamReadBits(stream, 1) != 0;
+}
+
+void BitStreamWriteInt(BitStream *stream, int32 value, int32 min, int32 max) {
+    ASSERT(min < max);
+    ASSERT(value >= min && value <= max);
+    BitStreamWriteBits(stream, (uint32)(value - min), BitsRequired((uint32)(max - min)));
+}
+
+int32 BitStreamReadInt(BitStream *stream, int32 min, int32 max) {
+    ASSERT(min < max);
+    uint32 value = BitStreamReadBits(stream, BitsRequired((uint32)(max - min)));
+    if(value > (uint32)(max - min)) {
+        stream->overflow = true;
+        return min;
+    }
+    return min + (int32)value;
+}
+
+// 7 bits of the value per byte, the high bit tells if there is more to read
+void BitStreamWriteVarint(BitStream *stream, uint32 value) {
+    do {
+        uint32 group = value & 0x7F;
+        value >>= 7;
+        BitStreamWriteBits(stream, group | (value ? 0x80 : 0), 8);
+    } while(value);
+}
+
+uint32 BitStreamReadVarint(BitStream *stream) {
+    uint32 value = 0;
+    for(int32 shift = 0; shift < 35; shift += 7) {
+        uint32 group = BitStreamReadBits(stream, 8);
+        value |= (group & 0x7F) << shift;
+        if((group & 0x80) == 0) {
+            return value;
+        }
+    }
+    stream->overflow = true;
+    return 0;
+}
+
+static uint32 FloatToQuantized(float32 value, float32 min, float32 max, int32 bitCount) {
+    uint32 maxValue = bitCount == 32 ? 0xFFFFFFFF : (1u << bitCount) - 1;
+    value = Min(Max(value, min), max);
+    float32 t = (value - min) / (max - min);
+    return (uint32)(t * (float32)maxValue + 0.5f);
+}
+
+static float32 QuantizedToFloat(uint32 value, float32 min, float32 max, int32 bitCount) {
+    uint32 maxValue = bitCount == 32 ? 0xFFFFFFFF : (1u << bitCount) - 1;
+    float32 t = (float32)value / (float32)maxValue;
+    return min + t * (max - min);
+}
+
+void BitStreamWriteFloat(BitStream *stream, float32 value, float32 min, float32 max, int32 bitCount) {
+    BitStreamWriteBits(stream, FloatToQuantized(value, min, max, bitCount), bitCount);
+}
+
+float32 BitStreamReadFloat(BitStream *stream, float32 min, float32 max, int32 bitCount) {
+    return QuantizedToFloat(BitStreamReadBits(stream, bitCount), min, max, bitCount);
+}
+
+void BitStreamWriteVec2(BitStream *stream, Vec2 value, float32 min, float32 max, int32 bitCount) {
+    BitStreamWriteFloat(stream, value.x, min, max, bitCount);
+    BitStreamWriteFloat(stream, value.y, min, max, bitCount);
+}
+
+Vec2 BitStreamReadVec2(BitStream *stream, float32 min, float32 max, int32 bitCount) {
+    Vec2 result;
+    result.x = BitStreamReadFloat(stream, min, max, bitCount);
+    result.y = BitStreamReadFloat(stream, min, max, bitCount);
+    return result;
+}
+
+float32 QuantizeFloat(float32 value, float32 min, float32 max, int32 bitCount) {
+    return QuantizedToFloat(FloatToQuantized(value, min, max, bitCount), min, max, bitCount);
+}
+
+Vec2 QuantizeVec2(Vec2 value, float32 min, float32 max, int32 bitCount) {
+    return Vec2(QuantizeFloat(value.x, min, max, bitCount), QuantizeFloat(value.y, min, max, bitCount));
+}
+
 // HashMap -----------------------------------------------------------------------------------------
 uint32 MurMur2(const void *key, int32 len, uint32 seed) {
     const uint32 m = 0x5bd1e995;
@@ -136,119 +302,254 @@ uint32 MurMur2(const void *key, int32 len, uint32 seed) {
     return h;
 }
 
+struct Crc32Table {
+    uint32 values[256];
+};
+
+static Crc32Table Crc32TableCreate() {
+    Crc32Table table;
+    for(uint32 i = 0; i < 256; ++i) {
+        uint32 value = i;
+        for(int32 j = 0; j < 8; ++j) {
+            value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+        }
+        table.values[i] = value;
+    }
+    return table;
+}
+
+// crc can be the result of a previous call to checksum data in pieces
+uint32 Crc32(const void *data, size_t size, uint32 crc) {
+    static const Crc32Table table = Crc32TableCreate();
+    const uint8 *bytes = (const uint8 *)data;
+    crc = ~crc;
+    for(size_t i = 0; i < size; ++i) {
+        crc = table.values[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 template <typename Type>
-void HashMap<Type>::Initialize(Arena *arena, uint32 size) {
+typename HashMap<Type>::Table HashMap<Type>::CreateTable(uint32 size) {
     ASSERT(IS_POWER_OF_TWO(size));
-    capacity = size;
-    mask     = (size - 1);
-    occupied = 0;
+    Table result;
+    result.capacity = size;
+    result.mask     = (size - 1);
+    result.occupied = 0;
+    result.maxProbe = 0;
+    result.elements = (HashElement *)ArenaPushSize(arena, sizeof(HashElement) * size);
+    memset((void *)result.elements, 0, sizeof(HashElement) * size);
+    return result;
+}
 
-    elements = (HashElement *)ArenaPushSize(arena, sizeof(HashElement) * capacity);
-    memset(elements, 0, sizeof(HashElement) * capacity);
+template <typename Type>
+void HashMap<Type>::Initialize(Arena *arena, uint32 size, bool growable) {
+    this->arena = arena;
+    this->growable = growable;
+    table = CreateTable(size);
+    memset(&oldTable, 0, sizeof(Table));
+    rehashIndex = 0;
     seed = 123;
 }
 
 
 template <typename Type>
 void HashMap<Type>::Clear() {
-    occupied = 0;
-    memset(elements, 0, sizeof(HashElement) * capacity);
+    table.occupied = 0;
+    table.maxProbe = 0;
+    memset((void *)table.elements, 0, sizeof(HashElement) * table.capacity);
+    memset(&oldTable, 0, sizeof(Table));
+    rehashIndex = 0;
 }
 
+template <typename Type>
+uint32 HashMap<Type>::Count() {
+    return table.occupied + oldTable.occupied;
+}
 
 template <typename Type>
-void HashMap<Type>::Add(uint64 key, Type value) {
+uint32 HashMap<Type>::SlotCount() {
+    return table.capacity + oldTable.capacity;
+}
+
+template <typename Type>
+typename HashMap<Type>::HashElement *HashMap<Type>::Slot(uint32 index) {
+    if(index < table.capacity) {
+        return table.elements + index;
+    }
+    return oldTable.elements + (index - table.capacity);
+}
 
-    ASSERT(occupied + 1 <= capacity);
+template <typename Type>
+bool HashMap<Type>::Occupied(uint32 index) {
+    return Slot(index)->hash != HASH_ELEMENT_EMPTY;
+}
 
-    uint32 id = MurMur2(&key, sizeof(uint64), seed);
-    uint32 index = (id & mask);
+template <typename Type>
+Type *HashMap<Type>::ValueAt(uint32 index) {
+    return &Slot(index)->value;
+}
+
+template <typename Type>
+uint32 HashMap<Type>::Hash(uint64 key) {
+    uint32 hash = MurMur2(&key, sizeof(uint64), seed);
+    // keep the marker value for the free slots
+    if(hash == HASH_ELEMENT_EMPTY) {
+        hash = 1;
+    }
+    return hash;
+}
 
-    ASSERT(id != HASH_ELEMENT_DELETED);
+template <typename Type>
+uint32 HashMap<Type>::Distance(Table *table, uint32 index) {
+    return (index - (table->elements[index].hash & table->mask)) & table->mask;
+}
 
-    if(elements[index].id == 0 || elements[index].id == HASH_ELEMENT_DELETED) {
-        HashElement *element = elements + index;
-        element->id = id;
-        element->value = value;
-        occupied++;
-    } else {
-        uint32 nextIndex = (index + 1) % capacity;
-        while(elements[nextIndex].id != 0 && elements[nextIndex].id != HASH_ELEMENT_DELETED) {
-            nextIndex = (nextIndex + 1) % capacity;
+template <typename Type>
+int32 HashMap<Type>::Find(Table *table, uint64 key, uint32 hash) {
+    if(table->occupied == 0) {
+        return -1;
+    }
+    uint32 index = (hash & table->mask);
+    for(uint32 distance = 0; distance <= table->maxProbe; ++distance) {
+        HashElement *element = table->elements + index;
+        if(element->hash == hash && element->key == key) {
+            return (int32)index;
+        }
+        // an element closer to home than us would have been displaced by our key
+        if(element->hash == HASH_ELEMENT_EMPTY || Distance(table, index) < distance) {
+            return -1;
         }
-        HashElement *element = elements + nextIndex;
-        element->id = id;
-        element->value = value;
-        occupied++;
+        index = (index + 1) & table->mask;
     }
+    return -1;
 }
 
 template <typename Type>
-void HashMap<Type>::Add(const char *key, Type value) {
+void HashMap<Type>::Insert(Table *table, HashElement carried) {
+    ASSERT(table->occupied + 1 <= table->capacity);
+    table->occupied++;
+
+    uint32 index = (carried.hash & table->mask);
+    uint32 distance = 0;
+    for(;;) {
+        HashElement *element = table->elements + index;
+        if(element->hash == HASH_ELEMENT_EMPTY) {
+            *element = carried;
+            table->maxProbe = Max(table->maxProbe, distance);
+            return;
+        }
+        uint32 elementDistance = Distance(table, index);
+        if(elementDistance < distance) {
+            // take the slot from the element closer to home and find a place for it
+            HashElement displaced = *element;
+            *element = carried;
+            table->maxProbe = Max(table->maxProbe, distance);
+            carried = displaced;
+            distance = elementDistance;
+        }
+        index = (index + 1) & table->mask;
+        ++distance;
+    }
+}
 
-    ASSERT(occupied + 1 <= capacity);
+template <typename Type>
+void HashMap<Type>::RemoveAt(Table *table, uint32 index) {
+    // move back every element after it until an empty slot or one already at home
+    uint32 next = (index + 1) & table->mask;
+    while(table->elements[next].hash != HASH_ELEMENT_EMPTY && Distance(table, next) > 0) {
+        table->elements[index] = table->elements[next];
+        index = next;
+        next = (next + 1) & table->mask;
+    }
+    table->elements[index].hash = HASH_ELEMENT_EMPTY;
+    table->occupied--;
+}
 
-    uint32 id = MurMur2(key, strlen(key), seed);
-    uint32 index = (id & mask);
-    
-    ASSERT(id != HASH_ELEMENT_DELETED);
-
-    if(elements[index].id == 0 || elements[index].id == HASH_ELEMENT_DELETED) {
-        HashElement *element = elements + index;
-        element->id = id;
-        element->value = value;
-        occupied++;
-    } else {
-        uint32 nextIndex = (index + 1) % capacity;
-        while(elements[nextIndex].id != 0 && elements[nextIndex].id != HASH_ELEMENT_DELETED) {
-            nextIndex = (nextIndex + 1) % capacity;
+// The backward shift of RemoveAt only moves elements into the slot it empties, so taking
+// the elements out at rehashIndex until it is empty never moves one behind it
+template <typename Type>
+void HashMap<Type>::RehashStep(uint32 slotCount) {
+    for(uint32 step = 0; step < slotCount && oldTable.elements; ++step) {
+        if(oldTable.occupied == 0 || rehashIndex >= oldTable.capacity) {
+            memset(&oldTable, 0, sizeof(Table));
+            rehashIndex = 0;
+            break;
         }
-        HashElement *element = elements + nextIndex;
-        element->id = id;
-        element->value = value;
-        occupied++;
+        HashElement *element = oldTable.elements + rehashIndex;
+        if(element->hash == HASH_ELEMENT_EMPTY) {
+            rehashIndex++;
+            continue;
+        }
+        Insert(&table, *element);
+        RemoveAt(&oldTable, rehashIndex);
     }
 }
 
-template<typename Type>
-void HashMap<Type>::Remove(uint64 key) {
-
-    uint32 id = MurMur2(&key, sizeof(uint64), seed);
-    uint32 index = (id & mask);
+template <typename Type>
+void HashMap<Type>::Grow() {
+    // finish the previous move first, there is room for one old table only
+    while(oldTable.elements) {
+        RehashStep(oldTable.capacity);
+    }
+    oldTable = table;
+    table = CreateTable(table.capacity * 2);
+    rehashIndex = 0;
+}
 
-    ASSERT(id != HASH_ELEMENT_DELETED);
+template <typename Type>
+void HashMap<Type>::Add(uint64 key, Type value) {
+    uint32 hash = Hash(key);
+    int32 found = Find(&table, key, hash);
+    if(found >= 0) {
+        table.elements[found].value = value;
+        return;
+    }
+    found = Find(&oldTable, key, hash);
+    if(found >= 0) {
+        oldTable.elements[found].value = value;
+        return;
+    }
 
-    uint32 counter = 0;
-    while((elements[index].id != 0 && elements[index].id != id) && counter < capacity) {
-        index = (index + 1) % capacity;
-        ++counter;
+    if(growable) {
+        if((Count() + 1) * HashMapMaxLoadDenominator > table.capacity * HashMapMaxLoadNumerator) {
+            Grow();
+        }
+    }
+    else {
+        ASSERT(table.occupied + 1 <= table.capacity);
     }
 
-    if(elements[index].id != 0 && counter <= capacity) {
-        elements[index].id = HASH_ELEMENT_DELETED;
-        occupied--;
+    HashElement element;
+    element.hash = hash;
+    element.key = key;
+    element.value = value;
+    Insert(&table, element);
+    RehashStep(HashMapRehashStep);
+}
+
+template<typename Type>
+void HashMap<Type>::Remove(uint64 key) {
+    uint32 hash = Hash(key);
+    int32 found = Find(&table, key, hash);
+    if(found >= 0) {
+        RemoveAt(&table, (uint32)found);
+    }
+    else if((found = Find(&oldTable, key, hash)) >= 0) {
+        RemoveAt(&oldTable, (uint32)found);
     }
     else {
         printf("Element you are trying to delete was not found\n");
+        return;
     }
+    RehashStep(HashMapRehashStep);
 }
 
 template <typename Type>
 Type HashMap<Type>::Get(uint64 key) {
-
-    uint32 id = MurMur2(&key, sizeof(uint64), seed);
-    uint32 index = (id & mask);
-
-    ASSERT(id != HASH_ELEMENT_DELETED);
-
-    uint32 counter = 0;
-    while((elements[index].id != 0 && elements[index].id != id) && counter < capacity) {
-        index = (index + 1) % capacity;
-        ++counter;
-    }
-
-    if(elements[index].id != 0 && elements[index].id != HASH_ELEMENT_DELETED && counter <= capacity) {
-        return elements[index].value;
+    Type *value = GetPtr(key);
+    if(value) {
+        return *value;
     }
     
     Type zero = {0};
@@ -257,40 +558,94 @@ Type HashMap<Type>::Get(uint64 key) {
 
 template <typename Type>
 Type *HashMap<Type>::GetPtr(uint64 key) {
-    uint32 id = MurMur2(&key, sizeof(uint64), seed);
-    uint32 index = (id & mask);
-    uint32 counter = 0;
+    uint32 hash = Hash(key);
+    int32 found = Find(&table, key, hash);
+    if(found >= 0) {
+        return &table.elements[found].value;
+    }
+    found = Find(&oldTable, key, hash);
+    if(found >= 0) {
+        return &oldTable.elements[found].value;
+    }
 
-    ASSERT(id != HASH_ELEMENT_DELETED);
-    
-    while((elements[index].id != 0 && elements[index].id != id) && counter < capacity) {
-        index = (index + 1) % capacity;
-        ++counter;
+    return nullptr;    
+}
+
+template <typename Type>
+void SlotMap<Type>::Initialize(Arena *arena, uint32 capacity) {
+    ASSERT(capacity <= SLOT_HANDLE_INDEX_MASK + 1);
+    this->capacity = capacity;
+    elements = ArenaPushArray(arena, capacity, Type);
+    handles = ArenaPushArray(arena, capacity, SlotHandle);
+    slots = ArenaPushArray(arena, capacity, uint32);
+    generations = ArenaPushArray(arena, capacity, uint32);
+    for(uint32 i = 0; i < capacity; ++i) {
+        // generation 0 is kept out so no handle is 0
+        generations[i] = 1;
     }
+    count = 0;
+    Clear();
+}
 
-    if(elements[index].id != 0 && elements[index].id != HASH_ELEMENT_DELETED && counter <= capacity) {
-        return &elements[index].value;
+template <typename Type>
+void SlotMap<Type>::Clear() {
+    while(count > 0) {
+        Remove(handles[count - 1]);
     }
+    // the free list goes back to slot order
+    for(uint32 i = 0; i < capacity; ++i) {
+        slots[i] = i + 1;
+    }
+    firstFree = 0;
+}
 
-    return nullptr;    
+template <typename Type>
+uint32 SlotMap<Type>::Index(SlotHandle handle) {
+    return handle & SLOT_HANDLE_INDEX_MASK;
 }
 
 template <typename Type>
-Type *HashMap<Type>::Get(const char *key) {
-    uint32 id = MurMur2(key, strlen(key), seed);
-    uint32 index = (id & mask);
-    uint32 counter = 0;
+SlotHandle SlotMap<Type>::Add() {
+    ASSERT(count + 1 <= capacity);
+    uint32 index = firstFree;
+    firstFree = slots[index];
+
+    uint32 dense = count++;
+    slots[index] = dense;
+    SlotHandle handle = (generations[index] << SLOT_HANDLE_INDEX_BITS) | index;
+    handles[dense] = handle;
+    memset((void *)(elements + dense), 0, sizeof(Type));
+    return handle;
+}
 
-    ASSERT(id != HASH_ELEMENT_DELETED);
-    
-    while((elements[index].id != 0 && elements[index].id != id) && counter < capacity) {
-        index = (index + 1) % capacity;
-        ++counter;
+template <typename Type>
+Type *SlotMap<Type>::Get(SlotHandle handle) {
+    uint32 index = Index(handle);
+    if(index >= capacity || generations[index] != (handle >> SLOT_HANDLE_INDEX_BITS)) {
+        return nullptr;
     }
+    return elements + slots[index];
+}
 
-    if(elements[index].id != 0 && elements[index].id != HASH_ELEMENT_DELETED && counter <= capacity) {
-        return &elements[index].value;
+template <typename Type>
+void SlotMap<Type>::Remove(SlotHandle handle) {
+    if(Get(handle) == nullptr) {
+        printf("Element you are trying to delete was not found\n");
+        return;
+    }
+    uint32 index = Index(handle);
+    uint32 dense = slots[index];
+
+    // fill the hole with the last element
+    uint32 last = --count;
+    if(dense != last) {
+        elements[dense] = elements[last];
+        handles[dense] = handles[last];
+        slots[Index(handles[dense])] = dense;
     }
 
-    return nullptr;    
+    uint32 generation = (generations[index] + 1) & ((1 << (32 - SLOT_HANDLE_INDEX_BITS)) - 1);
+    generations[index] = Max(generation, 1u);
+    slots[index] = firstFree;
+    firstFree = index;
 }
@@ -44,41 +44,166 @@ struct MemoryStream {
     size_t size;
 };
 
-// TODO: make a read bit stream ...
 MemoryStream MemoryStreamCreate();
 void MemoryStreamWrite(MemoryStream *stream, void *toWriteBuffer, size_t bufferSize);
 void MemoryStreamRead(MemoryStream *stream, void *toReadBuffer, size_t bufferSize);
 
-#define HASH_ELEMENT_DELETED 0xFFFFFFFF
+// Bit level stream used to pack network packets. Writing past the end ASSERTs,
+// reading past the end sets overflow and returns 0 so bad packets can be rejected
+struct BitStream {
+    uint8 *buffer;
+    size_t size;
+    size_t bitPosition;
+    bool overflow;
+};
 
-uint32 MurMur2(const void *key, int32 len, uint32 seed);
+BitStream BitStreamCreate(void *buffer, size_t bufferSize);
+size_t BitStreamBytesUsed(BitStream *stream);
+size_t BitStreamBitsLeft(BitStream *stream);
+int32 BitsRequired(uint32 range);
+
+void BitStreamWriteBits(BitStream *stream, uint32 value, int32 bitCount);
+void BitStreamWriteBool(BitStream *stream, bool value);
+void BitStreamWriteInt(BitStream *stream, int32 value, int32 min, int32 max);
+void BitStreamWriteVarint(BitStream *stream, uint32 value);
+void BitStreamWriteFloat(BitStream *stream, float32 value, float32 min, float32 max, int32 bitCount);
+void BitStreamWriteVec2(BitStream *stream, Vec2 value, float32 min, float32 max, int32 bitCount);
+void BitStreamWritePadding(BitStream *stream, size_t byteCount);
+
+uint32 BitStreamReadBits(BitStream *stream, int32 bitCount);
+bool BitStreamReadBool(BitStream *stream);
+int32 BitStreamReadInt(BitStream *stream, int32 min, int32 max);
+uint32 BitStreamReadVarint(BitStream *stream);
+float32 BitStreamReadFloat(BitStream *stream, float32 min, float32 max, int32 bitCount);
+Vec2 BitStreamReadVec2(BitStream *stream, float32 min, float32 max, int32 bitCount);
+
+// value after a round trip through Write/ReadFloat
+float32 QuantizeFloat(float32 value, float32 min, float32 max, int32 bitCount);
+Vec2 QuantizeVec2(Vec2 value, float32 min, float32 max, int32 bitCount);
+
+// hash of the free slots, the hash of a key is moved off this value
+#define HASH_ELEMENT_EMPTY 0
 
-// TODO: re implement this if is a good solution
+uint32 MurMur2(const void *key, int32 len, uint32 seed);
+uint32 Crc32(const void *data, size_t size, uint32 crc = 0);
+
+// Open addressing with Robin Hood linear probing. Every slot keeps the full key next to
+// its hash, the hash only makes the probe skip the slots of other keys cheaply and two
+// keys with the same hash are still two elements. An insert takes the slot of any
+// element closer to its home than the new one is and carries that element on, so
+// along a probe the distances never drop by more than one and a lookup stops as soon
+// as it reaches an element closer to home than itself. Remove shifts the elements
+// after it back one slot, there are no tombstones.
+//
+// A growable map doubles its table when it gets 3/4 full. The elements
+// move to the new table a few slots every Add and Remove so no single call pays for the
+// whole table, until then lookups check both tables. The tables come from the arena
+// of the map and the old ones are not given back, a map that grew to N slots left
+// less than N slots behind.
+//
+// Iterate over the elements with SlotCount / Occupied / ValueAt. Add and Remove can
+// move elements to other slots, don't call them while iterating
 template <typename Type>
 struct HashMap {
     
-    void Initialize(Arena *arena, uint32 size);
+    void Initialize(Arena *arena, uint32 size, bool growable = false);
 
+    // adding a key that is already there replaces its value
     void Add(uint64 key, Type value);
     Type Get(uint64 key);
     Type *GetPtr(uint64 key);
-    
-    void Add(const char *key, Type value);
-    Type *Get(const char *key);
 
     void Remove(uint64 key);
 
     void Clear();
 
+    uint32 Count();
+    uint32 SlotCount();
+    // true if the slot at index holds an element
+    bool Occupied(uint32 index);
+    Type *ValueAt(uint32 index);
+
     struct HashElement {
-        uint32 id;
+        uint32 hash;
+        uint64 key;
         Type value;
     };
 
-    uint32 occupied;
-    uint32 capacity;
-    uint32 mask;
-    HashElement *elements;
-    
+    struct Table {
+        HashElement *elements;
+        uint32 capacity;
+        uint32 mask;
+        uint32 occupied;
+        // longest distance an element got from its home in this table
+        uint32 maxProbe;
+    };
+
+    uint32 Hash(uint64 key);
+    HashElement *Slot(uint32 index);
+    Table CreateTable(uint32 size);
+    // how far the element at index is from its home slot
+    uint32 Distance(Table *table, uint32 index);
+    // slot of the key or -1
+    int32 Find(Table *table, uint64 key, uint32 hash);
+    void Insert(Table *table, HashElement element);
+    void RemoveAt(Table *table, uint32 index);
+    void Grow();
+    // move the elements of up to slotCount slots of the old table to the new one
+    void RehashStep(uint32 slotCount);
+
+    Table table;
+    // the table we are moving out of while growing, its elements are nullptr otherwise
+    Table oldTable;
+    // old table slots before this one are empty
+    uint32 rehashIndex;
+
+    Arena *arena;
+    bool growable;
     uint32 seed;
 };
+
+// a growable map grows before it gets fuller than this
+static const uint32 HashMapMaxLoadNumerator = 3;
+static const uint32 HashMapMaxLoadDenominator = 4;
+// slots of the old table every Add and Remove moves, with the table doubling at 3/4
+// load the move is over long before the new table needs to grow
+static const uint32 HashMapRehashStep = 16;
+
+// Handle to an element of a SlotMap, the low bits are the slot and the high bits the
+// generation of the slot when the element was added. 0 is never a valid handle
+typedef uint32 SlotHandle;
+
+#define SLOT_HANDLE_INDEX_BITS 16
+#define SLOT_HANDLE_INDEX_MASK ((1 << SLOT_HANDLE_INDEX_BITS) - 1)
+
+// Elements packed at the front of a dense array so iterating is a walk over elements
+// and count. Handles go through the slots to find where their element is, Remove moves
+// the last element in the hole it leaves and fixes its slot. Removing an element bumps
+// the generation of its slot, the handles to it stop working instead of pointing at
+// whatever takes the slot next. Pointers to elements are only good until the next Remove,
+// keep handles
+template <typename Type>
+struct SlotMap {
+
+    void Initialize(Arena *arena, uint32 capacity);
+
+    // the new element is zeroed
+    SlotHandle Add();
+    // nullptr if the element was removed
+    Type *Get(SlotHandle handle);
+    void Remove(SlotHandle handle);
+    void Clear();
+
+    // slot of the element, stays the same while it lives and is below capacity
+    uint32 Index(SlotHandle handle);
+
+    Type *elements;
+    // handle of every dense element
+    SlotHandle *handles;
+    // dense index of the element in the slot, or the next free slot
+    uint32 *slots;
+    uint32 *generations;
+    uint32 count;
+    uint32 capacity;
+    uint32 firstFree;
+};
@@ -5,6 +5,8 @@ uint32 IP(uint32 a, uint32 b, uint32 c, uint32 d) {
 
 UDPAddress UDPAddresCreate(uint32 ip, uint32 port) {
     UDPAddress result;
+    // the address is hashed and compared as raw bytes, the padding has to be zero
+    memset(&result, 0, sizeof(UDPAddress));
     sockaddr_in *inAddress = (sockaddr_in *)&result.addrs;
     inAddress->sin_family = AF_INET;
     inAddress->sin_addr.s_addr = htonl(ip);
@@ -12,9 +14,32 @@ UDPAddress UDPAddresCreate(uint32 ip, uint32 port) {
     return result;
 }
 
+uint32 UDPAddressIP(UDPAddress *address) {
+    return ntohl(((sockaddr_in *)&address->addrs)->sin_addr.s_addr);
+}
+
+uint16 UDPAddressPort(UDPAddress *address) {
+    return ntohs(((sockaddr_in *)&address->addrs)->sin_port);
+}
+
+// The ip and port packed in 64 bits, two addresses have the same key only if they are equal
+uint64 UDPAddressKey(UDPAddress *address) {
+    return ((uint64)UDPAddressIP(address) << 16) | (uint64)UDPAddressPort(address);
+}
+
+// A socket that drops everything sent to it and never receives anything, for running
+// the server without the network
+UDPSocket UDPSocketCreateNull() {
+    UDPSocket result;
+    result.handle = INVALID_SOCKET;
+    result.simulator = nullptr;
+    return result;
+}
+
 UDPSocket UDPSocketCreate() {
     UDPSocket result;
     result.handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    result.simulator = nullptr;
     if(result.handle <= 0) {
         printf("Error creating udp socket\n");
         ASSERT(!"INVALID_CODE_PATH");
@@ -23,6 +48,9 @@ UDPSocket UDPSocketCreate() {
 }
 
 void UDPSocketDestroy(UDPSocket *socket) {
+    if(socket->handle == INVALID_SOCKET) {
+        return;
+    }
 #if _WIN32
 	closesocket(socket->handle);
 #else
@@ -39,6 +67,15 @@ int32 UDPGetLastError() {
 	
 }
 
+// let several sockets bind the same address, on linux the kernel spreads the incoming
+// datagrams between them by hashing the source address. Must be called before bind
+void UDPSocketSetReusePort(UDPSocket *socket) {
+    int32 enable = 1;
+    if(setsockopt(socket->handle, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int32)) != 0) {
+        printf("Error setting SO_REUSEPORT\n");
+    }
+}
+
 void UDPSocketBind(UDPSocket *socket, UDPAddress *addrs) {
     if(bind(socket->handle, (const sockaddr *)&addrs->addrs, sizeof(sockaddr)) != 0) {
         printf("Error binding socket\n");
@@ -46,7 +83,7 @@ void UDPSocketBind(UDPSocket *socket, UDPAddress *addrs) {
     }
 }
 
-int32 UDPSocketSendTo(UDPSocket *socket, const void *inToSend, int32 inLength, UDPAddress *toAddrs) {
+static int32 UDPSocketSendToRaw(UDPSocket *socket, const void *inToSend, int32 inLength, UDPAddress *toAddrs) {
     int32 byteSentCount = sendto(socket->handle, static_cast<const char *>(inToSend), inLength,
             0, &toAddrs->addrs, sizeof(sockaddr));
 
@@ -58,7 +95,7 @@ int32 UDPSocketSendTo(UDPSocket *socket, const void *inToSend, int32 inLength, U
     }
 }
 
-int32 UDPSocketReceiveFrom(UDPSocket *socket, void *inToReceive, int32 inMaxLength, UDPAddress *outFromAddrs) {
+static int32 UDPSocketReceiveFromRaw(UDPSocket *socket, void *inToReceive, int32 inMaxLength, UDPAddress *outFromAddrs) {
     socklen_t fromLength =  sizeof(sockaddr); 
     int32 readByteCount = recvfrom(socket->handle, static_cast<char *>(inToReceive), inMaxLength,
             0, &outFromAddrs->addrs, &fromLength);
@@ -82,6 +119,336 @@ int32 UDPSocketReceiveFrom(UDPSocket *socket, void *inToReceive, int32 inMaxLeng
     }
 }
 
+// Network simulator
+
+static float64 NetworkTime() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (float64)now.tv_sec + (float64)now.tv_nsec / 1000000000.0;
+}
+
+static float32 NetworkSimulatorRandom(NetworkSimulator *simulator) {
+    // xorshift32
+    uint32 x = simulator->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    simulator->random = x;
+    return (float32)(x >> 8) / (float32)(1 << 24);
+}
+
+static void SimulatedQueueInitialize(SimulatedQueue *queue, Arena *arena, int32 capacity) {
+    queue->datagrams = ArenaPushArray(arena, capacity, SimulatedDatagram);
+    queue->order = ArenaPushArray(arena, capacity, int32);
+    queue->freeList = ArenaPushArray(arena, capacity, int32);
+    queue->count = 0;
+    queue->freeCount = capacity;
+    for(int32 i = 0; i < capacity; ++i) {
+        queue->freeList[i] = capacity - 1 - i;
+    }
+    queue->linkFreeTime = 0;
+}
+
+// Queue a copy of the datagram with the delay, loss, duplication and reordering of the config
+static void NetworkSimulatorPush(NetworkSimulator *simulator, SimulatedQueue *queue, const void *data, int32 length,
+                                 UDPAddress *address, float64 now) {
+    NetworkSimulatorConfig *config = &simulator->config;
+    if(NetworkSimulatorRandom(simulator) < config->loss) {
+        simulator->droppedCount++;
+        return;
+    }
+    int32 copies = 1;
+    if(NetworkSimulatorRandom(simulator) < config->duplicate) {
+        simulator->duplicatedCount++;
+        copies = 2;
+    }
+
+    for(int32 copy = 0; copy < copies; ++copy) {
+        if(queue->freeCount == 0) {
+            // like a router with a full buffer
+            simulator->overflowCount++;
+            return;
+        }
+
+        float64 sendTime = now;
+        if(config->bandwidth > 0) {
+            sendTime = Max(now, queue->linkFreeTime) + (float64)length / (float64)config->bandwidth;
+            queue->linkFreeTime = sendTime;
+        }
+        float64 deliveryTime = sendTime + config->latency + config->jitter * NetworkSimulatorRandom(simulator);
+        if(NetworkSimulatorRandom(simulator) < config->reorder) {
+            simulator->reorderedCount++;
+            deliveryTime += SimulatorReorderDelay;
+        }
+
+        int32 index = queue->freeList[--queue->freeCount];
+        SimulatedDatagram *datagram = queue->datagrams + index;
+        datagram->deliveryTime = deliveryTime;
+        datagram->length = Min(length, MaxDatagramSize);
+        datagram->address = *address;
+        memcpy(datagram->data, data, datagram->length);
+
+        // insertion keeps the order of datagrams with the same delivery time
+        int32 position = queue->count;
+        while(position > 0 && queue->datagrams[queue->order[position - 1]].deliveryTime > deliveryTime) {
+            queue->order[position] = queue->order[position - 1];
+            --position;
+        }
+        queue->order[position] = index;
+        queue->count++;
+    }
+}
+
+// Returns the first datagram of the queue if its delivery time has come, it stays valid
+// until the next push
+static SimulatedDatagram *NetworkSimulatorPop(SimulatedQueue *queue, float64 now) {
+    if(queue->count == 0) {
+        return nullptr;
+    }
+    int32 index = queue->order[0];
+    SimulatedDatagram *datagram = queue->datagrams + index;
+    if(datagram->deliveryTime > now) {
+        return nullptr;
+    }
+    memmove(queue->order, queue->order + 1, sizeof(int32) * (queue->count - 1));
+    queue->count--;
+    queue->freeList[queue->freeCount++] = index;
+    return datagram;
+}
+
+// Send the outgoing datagrams that are due and move everything the socket has to the
+// incoming queue
+static void NetworkSimulatorPump(UDPSocket *socket, float64 now) {
+    NetworkSimulator *simulator = socket->simulator;
+    SimulatedDatagram *datagram;
+    while((datagram = NetworkSimulatorPop(&simulator->outgoing, now)) != nullptr) {
+        UDPSocketSendToRaw(socket, datagram->data, datagram->length, &datagram->address);
+    }
+
+    uint8 buffer[MaxDatagramSize];
+    UDPAddress fromAddress;
+    int32 readByteCount;
+    while((readByteCount = UDPSocketReceiveFromRaw(socket, buffer, MaxDatagramSize, &fromAddress)) > 0) {
+        NetworkSimulatorPush(simulator, &simulator->incoming, buffer, readByteCount, &fromAddress, now);
+    }
+}
+
+bool NetworkSimulatorConfigIsActive(NetworkSimulatorConfig *config) {
+    return config->latency > 0 || config->jitter > 0 || config->loss > 0 ||
+           config->duplicate > 0 || config->reorder > 0 || config->bandwidth > 0;
+}
+
+NetworkSimulator *NetworkSimulatorCreate(Arena *arena, NetworkSimulatorConfig config, int32 capacity) {
+    NetworkSimulator *simulator = ArenaPushStruct(arena, NetworkSimulator);
+    memset(simulator, 0, sizeof(NetworkSimulator));
+    simulator->config = config;
+    simulator->capacity = capacity;
+    simulator->random = 0x9E3779B9;
+    SimulatedQueueInitialize(&simulator->incoming, arena, capacity);
+    SimulatedQueueInitialize(&simulator->outgoing, arena, capacity);
+    return simulator;
+}
+
+// The socket must be non blocking, the simulator reads everything the socket has
+void UDPSocketSetSimulator(UDPSocket *socket, NetworkSimulator *simulator) {
+    socket->simulator = simulator;
+}
+
+int32 UDPSocketSendTo(UDPSocket *socket, const void *inToSend, int32 inLength, UDPAddress *toAddrs) {
+    if(socket->handle == INVALID_SOCKET) {
+        return inLength;
+    }
+    if(socket->simulator == nullptr) {
+        return UDPSocketSendToRaw(socket, inToSend, inLength, toAddrs);
+    }
+    float64 now = NetworkTime();
+    NetworkSimulatorPush(socket->simulator, &socket->simulator->outgoing, inToSend, inLength, toAddrs, now);
+    NetworkSimulatorPump(socket, now);
+    return inLength;
+}
+
+int32 UDPSocketReceiveFrom(UDPSocket *socket, void *inToReceive, int32 inMaxLength, UDPAddress *outFromAddrs) {
+    if(socket->handle == INVALID_SOCKET) {
+        return 0;
+    }
+    if(socket->simulator == nullptr) {
+        return UDPSocketReceiveFromRaw(socket, inToReceive, inMaxLength, outFromAddrs);
+    }
+    float64 now = NetworkTime();
+    NetworkSimulatorPump(socket, now);
+    SimulatedDatagram *datagram = NetworkSimulatorPop(&socket->simulator->incoming, now);
+    if(datagram == nullptr) {
+        return 0;
+    }
+    int32 length = Min(datagram->length, inMaxLength);
+    memcpy(inToReceive, datagram->data, length);
+    *outFromAddrs = datagram->address;
+    return length;
+}
+
+// Batched versions of ReceiveFrom / SendTo. On linux one recvmmsg / sendmmsg call
+// moves up to MaxDatagramBatchCount datagrams, everywhere else we fall back to a loop.
+// ReceiveBatch returns the number of datagrams read (0 if there is nothing to read)
+// or a negative error like UDPSocketReceiveFrom, SendBatch returns the number of
+// datagrams sent or -1
+int32 UDPSocketReceiveBatch(UDPSocket *socket, UDPDatagram *datagrams, int32 count) {
+    count = Min(count, MaxDatagramBatchCount);
+    if(socket->handle == INVALID_SOCKET) {
+        return 0;
+    }
+    if(socket->simulator) {
+        int32 receivedCount = 0;
+        while(receivedCount < count) {
+            UDPDatagram *datagram = datagrams + receivedCount;
+            int32 readByteCount = UDPSocketReceiveFrom(socket, datagram->data, datagram->length, &datagram->address);
+            if(readByteCount <= 0) {
+                break;
+            }
+            datagram->length = readByteCount;
+            ++receivedCount;
+        }
+        return receivedCount;
+    }
+#if __linux__
+    mmsghdr messages[MaxDatagramBatchCount];
+    iovec iovecs[MaxDatagramBatchCount];
+    memset(messages, 0, sizeof(mmsghdr) * count);
+    for(int32 i = 0; i < count; ++i) {
+        iovecs[i].iov_base = datagrams[i].data;
+        iovecs[i].iov_len = datagrams[i].length;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &datagrams[i].address.addrs;
+        messages[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+    }
+
+    int32 receivedCount = recvmmsg(socket->handle, messages, count, MSG_DONTWAIT, nullptr);
+    if(receivedCount >= 0) {
+        for(int32 i = 0; i < receivedCount; ++i) {
+            datagrams[i].length = messages[i].msg_len;
+        }
+        return receivedCount;
+    }
+    else {
+        int32 error = UDPGetLastError();
+        if(error == WSAEWOULDBLOCK) {
+            return 0;
+        }
+        return -error;
+    }
+#else
+    int32 receivedCount = 0;
+    while(receivedCount < count) {
+        UDPDatagram *datagram = datagrams + receivedCount;
+        int32 readByteCount = UDPSocketReceiveFrom(socket, datagram->data, datagram->length, &datagram->address);
+        if(readByteCount > 0) {
+            datagram->length = readByteCount;
+            ++receivedCount;
+        }
+        else {
+            // report the error only if it is the first thing we read, otherwise return
+            // what we have and the next call will get the error again
+            if(readByteCount < 0 && receivedCount == 0) {
+                return readByteCount;
+            }
+            break;
+        }
+    }
+    return receivedCount;
+#endif
+}
+
+int32 UDPSocketSendBatch(UDPSocket *socket, UDPDatagram *datagrams, int32 count) {
+    int32 sentCount = 0;
+    if(socket->handle == INVALID_SOCKET) {
+        return count;
+    }
+    if(socket->simulator) {
+        for(; sentCount < count; ++sentCount) {
+            UDPDatagram *datagram = datagrams + sentCount;
+            UDPSocketSendTo(socket, datagram->data, datagram->length, &datagram->address);
+        }
+        return sentCount;
+    }
+#if __linux__
+    mmsghdr messages[MaxDatagramBatchCount];
+    iovec iovecs[MaxDatagramBatchCount];
+    while(sentCount < count) {
+        int32 batchCount = Min(count - sentCount, MaxDatagramBatchCount);
+        memset(messages, 0, sizeof(mmsghdr) * batchCount);
+        for(int32 i = 0; i < batchCount; ++i) {
+            UDPDatagram *datagram = datagrams + sentCount + i;
+            iovecs[i].iov_base = datagram->data;
+            iovecs[i].iov_len = datagram->length;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &datagram->address.addrs;
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+        }
+        int32 result = sendmmsg(socket->handle, messages, batchCount, 0);
+        if(result <= 0) {
+            break;
+        }
+        sentCount += result;
+    }
+#else
+    for(; sentCount < count; ++sentCount) {
+        UDPDatagram *datagram = datagrams + sentCount;
+        if(UDPSocketSendTo(socket, datagram->data, datagram->length, &datagram->address) != datagram->length) {
+            break;
+        }
+    }
+#endif
+    if(sentCount == 0 && count > 0) {
+        return -1;
+    }
+    return sentCount;
+}
+
+// Block until the socket has something to read or timeout (in seconds) expires.
+// Returns 1 if there is data, 0 on timeout and a negative error otherwise
+int32 UDPSocketWaitForData(UDPSocket *socket, float64 timeout) {
+    if(socket->handle == INVALID_SOCKET) {
+        return 0;
+    }
+    if(socket->simulator) {
+        // wake up in time to deliver the next queued datagram in either direction
+        float64 now = NetworkTime();
+        NetworkSimulatorPump(socket, now);
+        SimulatedQueue *queues[2] = {&socket->simulator->incoming, &socket->simulator->outgoing};
+        for(int32 i = 0; i < 2; ++i) {
+            if(queues[i]->count > 0) {
+                float64 deliveryTime = queues[i]->datagrams[queues[i]->order[0]].deliveryTime;
+                timeout = Min(timeout, deliveryTime - now);
+            }
+        }
+    }
+    pollfd fd;
+    fd.fd = socket->handle;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    if(timeout < 0) {
+        timeout = 0;
+    }
+#if __linux__
+    // ppoll takes a timespec so we dont lose the sub millisecond part of the tick
+    timespec time;
+    time.tv_sec = (time_t)timeout;
+    time.tv_nsec = (long)((timeout - (float64)time.tv_sec) * 1000000000.0);
+    int32 result = ppoll(&fd, 1, &time, nullptr);
+#else
+    int32 result = poll(&fd, 1, (int32)(timeout * 1000.0));
+#endif
+    if(result < 0) {
+        int32 error = UDPGetLastError();
+        if(error == EINTR) {
+            return 0;
+        }
+        return -error;
+    }
+    return result > 0 ? 1 : 0;
+}
+
 int32 UDPSocketSetNonBlockingMode(UDPSocket *socket, bool inShouldBeNonBlocking )
 {
 #if _WIN32
@@ -5,6 +5,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <time.h>
 
 typedef int SOCKET;
 const int NO_ERROR = 0;
@@ -17,16 +20,89 @@ struct UDPAddress {
     sockaddr addrs; 
 };
 
+static const int32 MaxDatagramSize = 1200;
+static const int32 MaxDatagramBatchCount = 64;
+
+// Bad link simulation for testing. Every datagram the socket sends or receives waits in
+// a queue ordered by delivery time, both directions get the same conditions
+struct NetworkSimulatorConfig {
+    // seconds, one way
+    float32 latency;
+    // seconds, every datagram gets a random extra delay up to this
+    float32 jitter;
+    // chances from 0 to 1
+    float32 loss;
+    float32 duplicate;
+    float32 reorder;
+    // bytes per second, 0 means no limit
+    float32 bandwidth;
+};
+
+struct SimulatedDatagram {
+    float64 deliveryTime;
+    int32 length;
+    UDPAddress address;
+    uint8 data[MaxDatagramSize];
+};
+
+struct SimulatedQueue {
+    SimulatedDatagram *datagrams;
+    // indices into datagrams sorted by delivery time, and the free ones
+    int32 *order;
+    int32 *freeList;
+    int32 count;
+    int32 freeCount;
+    // when the link is done sending the last datagram, used for the bandwidth limit
+    float64 linkFreeTime;
+};
+
+struct NetworkSimulator {
+    NetworkSimulatorConfig config;
+    SimulatedQueue incoming;
+    SimulatedQueue outgoing;
+    int32 capacity;
+    uint32 random;
+
+    uint32 droppedCount;
+    uint32 duplicatedCount;
+    uint32 reorderedCount;
+    uint32 overflowCount;
+};
+
 struct UDPSocket {
     SOCKET handle;
+    // nullptr unless the link simulation is on
+    NetworkSimulator *simulator;
+};
+
+// extra delay of a reordered datagram on top of the latency
+static const float32 SimulatorReorderDelay = 0.03f;
+
+// one entry of a batched send or receive. On receive length is the capacity of data
+// and it is overwritten with the bytes read, on send it is the bytes to send
+struct UDPDatagram {
+    void *data;
+    int32 length;
+    UDPAddress address;
 };
 
 uint32 IP(uint32 a, uint32 b, uint32 c, uint32 d);
 UDPAddress UDPAddresCreate(uint32 ip, uint32 port);
+uint32 UDPAddressIP(UDPAddress *address);
+uint16 UDPAddressPort(UDPAddress *address);
+uint64 UDPAddressKey(UDPAddress *address);
 UDPSocket UDPSocketCreate();
+UDPSocket UDPSocketCreateNull();
 void UDPSocketDestroy(UDPSocket *socket);
 int32 UDPGetLastError();
+void UDPSocketSetReusePort(UDPSocket *socket);
 void UDPSocketBind(UDPSocket *socket, UDPAddress *addrs);
 int32 UDPSocketSendTo(UDPSocket *socket, const void *inToSend, int32 inLength, UDPAddress *toAddrs);
 int32 UDPSocketReceiveFrom(UDPSocket *socket, void *inToReceive, int32 inMaxLength, UDPAddress *outFromAddrs);
+int32 UDPSocketReceiveBatch(UDPSocket *socket, UDPDatagram *datagrams, int32 count);
+int32 UDPSocketSendBatch(UDPSocket *socket, UDPDatagram *datagrams, int32 count);
+int32 UDPSocketWaitForData(UDPSocket *socket, float64 timeout);
 int32 UDPSocketSetNonBlockingMode(UDPSocket *socket, bool inShouldBeNonBlocking );
+bool NetworkSimulatorConfigIsActive(NetworkSimulatorConfig *config);
+NetworkSimulator *NetworkSimulatorCreate(Arena *arena, NetworkSimulatorConfig config, int32 capacity);
+void UDPSocketSetSimulator(UDPSocket *socket, NetworkSimulator *simulator);
@@ -0,0 +1,135 @@
+//
+//  profiler.cpp
+//
+//  Tick profiler for the server. Every phase of the update is timed with the high
+//  resolution clock and the time spent in it since the previous tick goes into a
+//  histogram when a tick runs, so the percentiles are of work per tick and updates
+//  woken up by packets between ticks are charged to the next one.
+//
+
+uint64 ProfilerNow() {
+    return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ProfilerReset(Profiler *profiler, float64 time) {
+    memset(profiler->histograms, 0, sizeof(profiler->histograms));
+    profiler->windowStart = time;
+    profiler->tickCount = 0;
+    profiler->packetsIn = 0;
+    profiler->packetsOut = 0;
+    profiler->bytesIn = 0;
+    profiler->bytesOut = 0;
+    profiler->actions = 0;
+    profiler->actionHits = 0;
+}
+
+void ProfilerInitialize(Profiler *profiler, float64 time) {
+    memset(profiler, 0, sizeof(Profiler));
+    ProfilerReset(profiler, time);
+}
+
+void ProfilerBegin(Profiler *profiler, ProfilePhase phase) {
+    profiler->phaseStart[phase] = ProfilerNow();
+}
+
+void ProfilerEnd(Profiler *profiler, ProfilePhase phase) {
+    profiler->phaseTime[phase] += ProfilerNow() - profiler->phaseStart[phase];
+}
+
+void ProfilerCountReceived(Profiler *profiler, int32 bytes) {
+    profiler->packetsIn++;
+    profiler->bytesIn += bytes;
+}
+
+void ProfilerCountSent(Profiler *profiler, int32 bytes) {
+    profiler->packetsOut++;
+    profiler->bytesOut += bytes;
+}
+
+void ProfilerCountAction(Profiler *profiler, int32 hits) {
+    profiler->actions++;
+    profiler->actionHits += hits;
+}
+
+// the first buckets hold one microsecond each, after that every power of two gets
+// ProfileSubBucketCount buckets
+int32 ProfileBucketIndex(uint64 micros) {
+    if(micros < 2 * ProfileSubBucketCount) {
+        return (int32)micros;
+    }
+    int32 exponent = 4;
+    while((micros >> (exponent + 1)) != 0) {
+        ++exponent;
+    }
+    int32 subBucket = (int32)(micros >> (exponent - 3)) & (ProfileSubBucketCount - 1);
+    int32 index = 2 * ProfileSubBucketCount + (exponent - 4) * ProfileSubBucketCount + subBucket;
+    return Min(index, ProfileBucketCount - 1);
+}
+
+// biggest value that goes in the bucket
+uint64 ProfileBucketValue(int32 index) {
+    if(index < 2 * ProfileSubBucketCount) {
+        return (uint64)index;
+    }
+    int32 exponent = (index - 2 * ProfileSubBucketCount) / ProfileSubBucketCount + 4;
+    int32 subBucket = (index - 2 * ProfileSubBucketCount) % ProfileSubBucketCount;
+    return ((uint64)(ProfileSubBucketCount + subBucket + 1) << (exponent - 3)) - 1;
+}
+
+void ProfileHistogramAdd(ProfileHistogram *histogram, uint64 nanoseconds) {
+    uint64 micros = nanoseconds / 1000;
+    histogram->buckets[ProfileBucketIndex(micros)]++;
+    histogram->count++;
+    histogram->max = Max(histogram->max, nanoseconds);
+}
+
+// in seconds, the upper bound of the bucket the percentile falls in
+float32 ProfileHistogramPercentile(ProfileHistogram *histogram, float32 percentile) {
+    if(histogram->count == 0) {
+        return 0;
+    }
+    uint32 target = Max((uint32)ceilf(percentile * (float32)histogram->count), 1u);
+    uint32 seen = 0;
+    for(int32 i = 0; i < ProfileBucketCount; ++i) {
+        seen += histogram->buckets[i];
+        if(seen >= target) {
+            uint64 nanoseconds = Min(ProfileBucketValue(i) * 1000 + 999, histogram->max);
+            return (float32)nanoseconds / 1000000000.0f;
+        }
+    }
+    return (float32)histogram->max / 1000000000.0f;
+}
+
+// Call at the end of every update, tickCount is how many ticks it ran
+void ProfilerFrameEnd(Profiler *profiler, int32 tickCount) {
+    if(tickCount == 0) {
+        return;
+    }
+    for(int32 i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        // catch up updates run more than one tick, split their time evenly
+        uint64 perTick = profiler->phaseTime[i] / tickCount;
+        for(int32 j = 0; j < tickCount; ++j) {
+            ProfileHistogramAdd(profiler->histograms + i, perTick);
+        }
+        profiler->phaseTime[i] = 0;
+    }
+    profiler->tickCount += tickCount;
+}
+
+void ProfilerGetStats(Profiler *profiler, float64 time, StatsPacket *stats) {
+    stats->window = (float32)(time - profiler->windowStart);
+    stats->tickCount = profiler->tickCount;
+    for(int32 i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        ProfileHistogram *histogram = profiler->histograms + i;
+        stats->phases[i].p50 = ProfileHistogramPercentile(histogram, 0.5f);
+        stats->phases[i].p99 = ProfileHistogramPercentile(histogram, 0.99f);
+        stats->phases[i].max = (float32)histogram->max / 1000000000.0f;
+    }
+    stats->packetsIn = profiler->packetsIn;
+    stats->packetsOut = profiler->packetsOut;
+    stats->bytesIn = profiler->bytesIn;
+    stats->bytesOut = profiler->bytesOut;
+    stats->actions = profiler->actions;
+    stats->actionHits = profiler->actionHits;
+}
@@ -0,0 +1,313 @@
+// Packet framing
+
+static uint32 PacketChecksum(uint8 *payload, int32 payloadSize) {
+    uint32 crc = Crc32(&PacketHeader, sizeof(uint32));
+    return Crc32(payload, payloadSize, crc);
+}
+
+// Returns a stream that writes the payload after the prefix of buffer
+BitStream PacketBegin(void *buffer, int32 bufferSize) {
+    ASSERT(bufferSize > PacketPrefixSize);
+    return BitStreamCreate((uint8 *)buffer + PacketPrefixSize, bufferSize - PacketPrefixSize);
+}
+
+// Fill the prefix of a stream created with PacketBegin, returns the number of bytes to send
+int32 PacketEnd(BitStream *stream) {
+    uint8 *packet = stream->buffer - PacketPrefixSize;
+    uint16 payloadSize = (uint16)BitStreamBytesUsed(stream);
+    uint32 checksum = PacketChecksum(stream->buffer, payloadSize);
+    memcpy(packet, &payloadSize, sizeof(uint16));
+    memcpy(packet + sizeof(uint16), &checksum, sizeof(uint32));
+    return PacketPrefixSize + payloadSize;
+}
+
+// Validate the length and checksum of a received datagram and return a stream over its payload
+bool PacketOpen(void *buffer, int32 receivedBytes, BitStream *outStream) {
+    if(receivedBytes <= PacketPrefixSize) {
+        return false;
+    }
+    uint8 *packet = (uint8 *)buffer;
+    uint16 payloadSize;
+    uint32 checksum;
+    memcpy(&payloadSize, packet, sizeof(uint16));
+    memcpy(&checksum, packet + sizeof(uint16), sizeof(uint32));
+    if(payloadSize != receivedBytes - PacketPrefixSize) {
+        return false;
+    }
+    uint8 *payload = packet + PacketPrefixSize;
+    if(checksum != PacketChecksum(payload, payloadSize)) {
+        return false;
+    }
+    *outStream = BitStreamCreate(payload, payloadSize);
+    return true;
+}
+
+// Packets, the type is read by the caller before the Read functions
+
+// HELLO, RESPONSE and STATS requests carry at most a cookie and are padded to
+// MinConnectPacketSize so the server never answers with more bytes than it got
+int32 WriteConnectPacket(void *buffer, PacketType type, uint32 cookie) {
+    BitStream stream = PacketBegin(buffer, MinConnectPacketSize);
+    BitStreamWriteInt(&stream, type, 0, PACKET_TYPE_COUNT - 1);
+    if(type == PACKET_TYPE_RESPONSE) {
+        BitStreamWriteBits(&stream, cookie, 32);
+    }
+    BitStreamWritePadding(&stream, MinConnectPacketSize - PacketPrefixSize);
+    return PacketEnd(&stream);
+}
+
+int32 WriteKeepalivePacket(void *buffer, int32 bufferSize, uint32 uid) {
+    BitStream stream = PacketBegin(buffer, bufferSize);
+    BitStreamWriteInt(&stream, PACKET_TYPE_KEEPALIVE, 0, PACKET_TYPE_COUNT - 1);
+    BitStreamWriteBits(&stream, uid, 32);
+    return PacketEnd(&stream);
+}
+
+int32 WriteWelcomePacket(void *buffer, int32 bufferSize, WelcomePacket *welcome) {
+    BitStream stream = PacketBegin(buffer, bufferSize);
+    BitStreamWriteInt(&stream, PACKET_TYPE_WELCOME, 0, PACKET_TYPE_COUNT - 1);
+    BitStreamWriteBits(&stream, welcome->uid, 32);
+    BitStreamWriteBits(&stream, welcome->tick, 32);
+    BitStreamWriteInt(&stream, welcome->tickRate, 1, MaxTickRate);
+    BitStreamWriteInt(&stream, welcome->shardIndex, 0, MaxShardCount - 1);
+    return PacketEnd(&stream);
+}
+
+void ReadWelcomePacket(BitStream *stream, WelcomePacket *welcome) {
+    welcome->uid = BitStreamReadBits(stream, 32);
+    welcome->tick = BitStreamReadBits(stream, 32);
+    welcome->tickRate = BitStreamReadInt(stream, 1, MaxTickRate);
+    welcome->shardIndex = BitStreamReadInt(stream, 0, MaxShardCount - 1);
+}
+
+// Write everything up to the input samples, the caller writes samplesCount samples
+// with WriteInputSample starting with the newest one and ends the packet
+BitStream BeginInputPacket(void *buffer, int32 bufferSize, Connection *connection, float64 time, uint32 uid,
+                           uint32 ackTick, float32 interpolationDelay, uint32 inputSequence, int32 samplesCount) {
+    BitStream stream = PacketBegin(buffer, bufferSize);
+    BitStreamWriteInt(&stream, PACKET_TYPE_INPUT, 0, PACKET_TYPE_COUNT - 1);
+    ConnectionWriteHeader(connection, &stream, time);
+    BitStreamWriteBits(&stream, uid, 32);
+    BitStreamWriteBits(&stream, ackTick, 32);
+    int32 delay = (int32)(interpolationDelay * 1000.0f + 0.5f);
+    BitStreamWriteInt(&stream, Min(Max(delay, 0), MaxReportedInterpolationDelay), 0, MaxReportedInterpolationDelay);
+    BitStreamWriteBits(&stream, inputSequence, 32);
+    BitStreamWriteInt(&stream, samplesCount, 0, MaxInputSampleCount);
+    return stream;
+}
+
+// the server only uses the direction of the input and if the action button is down
+void WriteInputSample(BitStream *stream, float32 inputX, float32 inputY, bool action) {
+    BitStreamWriteInt(stream, (int32)inputX, -1, 1);
+    BitStreamWriteInt(stream, (int32)inputY, -1, 1);
+    BitStreamWriteBool(stream, action);
+}
+
+void WriteStateHeader(BitStream *stream, StateHeader *header) {
+    BitStreamWriteBits(stream, header->tick, 32);
+    BitStreamWriteVarint(stream, header->baselineDistance);
+    BitStreamWriteBits(stream, header->lastAppliedInput, 32);
+}
+
+void ReadStateHeader(BitStream *stream, StateHeader *header) {
+    header->tick = BitStreamReadBits(stream, 32);
+    header->baselineDistance = BitStreamReadVarint(stream);
+    header->lastAppliedInput = BitStreamReadBits(stream, 32);
+}
+
+int32 WriteStatsPacket(void *buffer, int32 bufferSize, StatsPacket *stats) {
+    BitStream stream = PacketBegin(buffer, bufferSize);
+    BitStreamWriteInt(&stream, PACKET_TYPE_STATS, 0, PACKET_TYPE_COUNT - 1);
+    // times go in microseconds
+    BitStreamWriteVarint(&stream, (uint32)(stats->window * 1000000.0f));
+    BitStreamWriteVarint(&stream, stats->tickCount);
+    for(int32 i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        BitStreamWriteVarint(&stream, (uint32)(stats->phases[i].p50 * 1000000.0f));
+        BitStreamWriteVarint(&stream, (uint32)(stats->phases[i].p99 * 1000000.0f));
+        BitStreamWriteVarint(&stream, (uint32)(stats->phases[i].max * 1000000.0f));
+    }
+    BitStreamWriteVarint(&stream, stats->packetsIn);
+    BitStreamWriteVarint(&stream, stats->packetsOut);
+    BitStreamWriteVarint(&stream, stats->bytesIn);
+    BitStreamWriteVarint(&stream, stats->bytesOut);
+    BitStreamWriteVarint(&stream, stats->actions);
+    BitStreamWriteVarint(&stream, stats->actionHits);
+    BitStreamWriteInt(&stream, stats->tickRate, 1, MaxTickRate);
+    BitStreamWriteVarint(&stream, stats->clientCount);
+    BitStreamWriteVarint(&stream, stats->entityCount);
+    return PacketEnd(&stream);
+}
+
+void ReadStatsPacket(BitStream *stream, StatsPacket *stats) {
+    stats->window = (float32)BitStreamReadVarint(stream) / 1000000.0f;
+    stats->tickCount = BitStreamReadVarint(stream);
+    for(int32 i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        stats->phases[i].p50 = (float32)BitStreamReadVarint(stream) / 1000000.0f;
+        stats->phases[i].p99 = (float32)BitStreamReadVarint(stream) / 1000000.0f;
+        stats->phases[i].max = (float32)BitStreamReadVarint(stream) / 1000000.0f;
+    }
+    stats->packetsIn = BitStreamReadVarint(stream);
+    stats->packetsOut = BitStreamReadVarint(stream);
+    stats->bytesIn = BitStreamReadVarint(stream);
+    stats->bytesOut = BitStreamReadVarint(stream);
+    stats->actions = BitStreamReadVarint(stream);
+    stats->actionHits = BitStreamReadVarint(stream);
+    stats->tickRate = BitStreamReadInt(stream, 1, MaxTickRate);
+    stats->clientCount = BitStreamReadVarint(stream);
+    stats->entityCount = BitStreamReadVarint(stream);
+}
+
+void PrintStatsPacket(StatsPacket *stats) {
+    float32 window = Max(stats->window, 0.001f);
+    float32 tickBudget = 1.0f / (float32)stats->tickRate;
+    printf("ticks: %u clients: %d entities: %d in: %.0f packets/s %.1f KB/s out: %.0f packets/s %.1f KB/s\n",
+           stats->tickCount, stats->clientCount, stats->entityCount,
+           stats->packetsIn / window, stats->bytesIn / 1024.0f / window,
+           stats->packetsOut / window, stats->bytesOut / 1024.0f / window);
+    printf("  actions: %u reached: %u\n", stats->actions, stats->actionHits);
+    for(int32 i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        PhaseStats *phase = stats->phases + i;
+        printf("  %-8s p50: %.3fms p99: %.3fms max: %.3fms%s\n", ProfilePhaseNames[i],
+               phase->p50 * 1000.0f, phase->p99 * 1000.0f, phase->max * 1000.0f,
+               phase->max > tickBudget ? " over tick budget" : "");
+    }
+}
+
+// How many copies of an input a client sends so that all of them get lost with less
+// than InputLossTarget probability
+int32 InputRedundancy(float32 packetLoss) {
+    int32 count = MinInputRedundancy;
+    float32 allLost = powf(packetLoss, (float32)count);
+    while(count < MaxInputSampleCount && allLost > InputLossTarget) {
+        allLost *= packetLoss;
+        ++count;
+    }
+    return count;
+}
+
+// Connection
+
+// true if a is newer than b taking the wrap around into account
+bool SequenceGreaterThan(uint16 a, uint16 b) {
+    return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+}
+
+void ConnectionInitialize(Connection *connection) {
+    memset(connection, 0, sizeof(Connection));
+}
+
+// Write the header of the next packet and remember when it was sent to measure the rtt
+void ConnectionWriteHeader(Connection *connection, BitStream *stream, float64 time) {
+    uint16 sequence = connection->sequence++;
+    ConnectionSentPacket *sent = connection->sent + (sequence % ConnectionSentBufferSize);
+    sent->time = time;
+    sent->sequence = sequence;
+    sent->valid = true;
+    sent->acked = false;
+    connection->sentCount++;
+
+    BitStreamWriteBits(stream, sequence, 16);
+    // until we receive something the ack fields don't mean anything
+    BitStreamWriteBool(stream, connection->hasReceived);
+    BitStreamWriteBits(stream, connection->remoteSequence, 16);
+    BitStreamWriteBits(stream, connection->receivedBits, 32);
+}
+
+void ConnectionReadHeader(BitStream *stream, ConnectionHeader *header) {
+    header->sequence = (uint16)BitStreamReadBits(stream, 16);
+    header->hasAck = BitStreamReadBool(stream);
+    header->ack = (uint16)BitStreamReadBits(stream, 16);
+    header->ackBits = BitStreamReadBits(stream, 32);
+}
+
+static void ConnectionAckPacket(Connection *connection, uint16 sequence, float64 time) {
+    ConnectionSentPacket *sent = connection->sent + (sequence % ConnectionSentBufferSize);
+    if(!sent->valid || sent->sequence != sequence || sent->acked) {
+        return;
+    }
+    sent->acked = true;
+    connection->ackedCount++;
+
+    float32 sample = (float32)(time - sent->time);
+    if(connection->ackedCount == 1) {
+        connection->rtt = sample;
+        connection->jitter = 0;
+    }
+    else {
+        float32 deviation = sample - connection->rtt;
+        connection->jitter += (fabsf(deviation) - connection->jitter) * ConnectionJitterSmoothing;
+        connection->rtt += deviation * ConnectionRttSmoothing;
+    }
+}
+
+// Packets older than the ack window will never be acked, count the ones that weren't as lost
+static void ConnectionUpdateLoss(Connection *connection, uint16 ack) {
+    if(!connection->hasRemoteAck) {
+        connection->remoteAck = ack;
+        connection->hasRemoteAck = true;
+        return;
+    }
+    if(!SequenceGreaterThan(ack, connection->remoteAck)) {
+        return;
+    }
+    uint16 windowStart = (uint16)(connection->remoteAck - ConnectionAckBitCount);
+    uint16 newWindowStart = (uint16)(ack - ConnectionAckBitCount);
+    for(int32 i = 0; i < ConnectionSentBufferSize && SequenceGreaterThan(newWindowStart, windowStart); ++i) {
+        ConnectionSentPacket *sent = connection->sent + (windowStart % ConnectionSentBufferSize);
+        if(sent->valid && sent->sequence == windowStart) {
+            float32 lost = sent->acked ? 0.0f : 1.0f;
+            connection->lostCount += (uint32)lost;
+            connection->packetLoss += (lost - connection->packetLoss) * ConnectionLossSmoothing;
+            sent->valid = false;
+        }
+        ++windowStart;
+    }
+    connection->remoteAck = ack;
+}
+
+// Mark the sequence of a received header as received and apply its acks.
+// Returns false if the packet is a duplicate or too old to track, its payload should be ignored
+// and its acks too
+bool ConnectionProcessHeader(Connection *connection, ConnectionHeader *header, float64 time) {
+    if(!connection->hasReceived) {
+        connection->remoteSequence = header->sequence;
+        connection->receivedBits = 0;
+        connection->hasReceived = true;
+    }
+    else if(SequenceGreaterThan(header->sequence, connection->remoteSequence)) {
+        uint16 shift = (uint16)(header->sequence - connection->remoteSequence);
+        if(shift < ConnectionAckBitCount) {
+            connection->receivedBits = (connection->receivedBits << shift) | (1u << (shift - 1));
+        }
+        else if(shift == ConnectionAckBitCount) {
+            connection->receivedBits = 1u << (ConnectionAckBitCount - 1);
+        }
+        else {
+            connection->receivedBits = 0;
+        }
+        connection->remoteSequence = header->sequence;
+    }
+    else {
+        uint16 distance = (uint16)(connection->remoteSequence - header->sequence);
+        if(distance == 0 || distance > ConnectionAckBitCount) {
+            return false;
+        }
+        uint32 bit = 1u << (distance - 1);
+        if(connection->receivedBits & bit) {
+            return false;
+        }
+        connection->receivedBits |= bit;
+    }
+    connection->receivedCount++;
+
+    if(header->hasAck) {
+        ConnectionAckPacket(connection, header->ack, time);
+        for(int32 i = 0; i < ConnectionAckBitCount; ++i) {
+            if(header->ackBits & (1u << i)) {
+                ConnectionAckPacket(connection, (uint16)(header->ack - 1 - i), time);
+            }
+        }
+        ConnectionUpdateLoss(connection, header->ack);
+    }
+    return true;
+}
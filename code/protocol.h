@@ -0,0 +1,179 @@
+// Packet layout shared by the server and the client. Every datagram starts with a
+// prefix holding the payload length (16 bits) and a crc32 of PacketHeader plus the
+// payload. The payload is a BitStream that starts with a PacketType, packets sent
+// after the handshake (input and state) follow it with a ConnectionHeader
+//
+// Handshake: the client sends HELLO, the server answers with a CHALLENGE holding a
+// cookie derived from the client address and a secret, the client echoes it in a
+// RESPONSE and only then the server allocates the client and sends the WELCOME.
+// HELLO and RESPONSE are padded to MinConnectPacketSize so the server never answers
+// with more bytes than it got
+
+static const uint32 PacketHeader = 'PIPE';
+static const int32 PacketPrefixSize = sizeof(uint16) + sizeof(uint32);
+
+enum PacketType {
+    PACKET_TYPE_HELLO,
+    PACKET_TYPE_CHALLENGE,
+    PACKET_TYPE_RESPONSE,
+    PACKET_TYPE_WELCOME,
+    PACKET_TYPE_INPUT,
+    PACKET_TYPE_STATE,
+    PACKET_TYPE_KEEPALIVE,
+    PACKET_TYPE_STATS,
+
+    PACKET_TYPE_COUNT
+};
+
+// the client sends its unacknowledged inputs again with every input packet, as many
+// as the measured loss requires to get one copy through
+static const int32 MaxInputSampleCount = 16;
+static const int32 MinInputRedundancy = 2;
+// chance of every copy of an input getting lost we are willing to accept
+static const float32 InputLossTarget = 0.001f;
+// inputs the server buffers per client and the client keeps to replay after a correction
+static const int32 InputBufferSize = 64;
+static const int32 MaxTickRate = 255;
+static const int32 MaxShardCount = 256;
+// a connection that doesn't send anything for ConnectionTimeout seconds is dropped. The
+// server sends state every snapshot, the client sends a keepalive if it has been quiet
+// for KeepaliveInterval seconds
+static const float32 ConnectionTimeout = 5.0f;
+static const float32 KeepaliveInterval = 1.0f;
+static const int32 MinConnectPacketSize = 64;
+// the client reports how far behind the server it renders with every input packet, in milliseconds
+static const int32 MaxReportedInterpolationDelay = 1000;
+// meters per second, the server and the client prediction must move the player the same way
+static const float32 PlayerSpeed = 0.075f * 60.0f;
+
+// quantization of the entity state, positions are in meters with ~1mm precision
+static const float32 QuantizedPositionMin = -16.0f;
+static const float32 QuantizedPositionMax = 48.0f;
+static const int32   QuantizedPositionBits = 16;
+static const float32 QuantizedVelocityMin = -1.0f;
+static const float32 QuantizedVelocityMax = 1.0f;
+static const int32   QuantizedVelocityBits = 12;
+
+// Every connected packet carries its sequence number and acks the packets we received
+// from the other side: ack is the newest sequence and bit i of ackBits acks ack - 1 - i
+struct ConnectionHeader {
+    uint16 sequence;
+    // false while the sender hasn't received anything from us
+    bool hasAck;
+    uint16 ack;
+    uint32 ackBits;
+};
+
+struct ConnectionSentPacket {
+    float64 time;
+    uint16 sequence;
+    bool valid;
+    bool acked;
+};
+
+static const int32 ConnectionAckBitCount = 32;
+static const int32 ConnectionSentBufferSize = 256;
+static const float32 ConnectionRttSmoothing = 0.1f;
+static const float32 ConnectionJitterSmoothing = 1.0f / 16.0f;
+static const float32 ConnectionLossSmoothing = 0.05f;
+
+struct Connection {
+    // next sequence we send
+    uint16 sequence;
+    // newest sequence we received and the ones before it we also received
+    uint16 remoteSequence;
+    uint32 receivedBits;
+    bool hasReceived;
+
+    // packets we sent waiting for an ack, indexed by sequence
+    ConnectionSentPacket sent[ConnectionSentBufferSize];
+    // newest ack the other side sent us, packets that leave the ack window without
+    // being acked are counted as lost
+    uint16 remoteAck;
+    bool hasRemoteAck;
+
+    // smoothed estimates in seconds, packetLoss goes from 0 to 1
+    float32 rtt;
+    float32 jitter;
+    float32 packetLoss;
+
+    uint32 sentCount;
+    uint32 receivedCount;
+    uint32 ackedCount;
+    uint32 lostCount;
+};
+
+bool SequenceGreaterThan(uint16 a, uint16 b);
+void ConnectionInitialize(Connection *connection);
+void ConnectionWriteHeader(Connection *connection, BitStream *stream, float64 time);
+void ConnectionReadHeader(BitStream *stream, ConnectionHeader *header);
+bool ConnectionProcessHeader(Connection *connection, ConnectionHeader *header, float64 time);
+
+struct WelcomePacket {
+    uint32 uid;
+    uint32 tick;
+    int32 tickRate;
+    int32 shardIndex;
+};
+
+// goes after the connection header of a state packet, the snapshot delta follows it
+struct StateHeader {
+    uint32 tick;
+    // distance from tick to the baseline tick, 0 means no baseline
+    uint32 baselineDistance;
+    // last input the server applied to the player of the receiver
+    uint32 lastAppliedInput;
+};
+
+// parts of a server update the profiler times, UPDATE is the whole of it
+enum ProfilePhase {
+    PROFILE_PHASE_RECEIVE,
+    PROFILE_PHASE_SIMULATE,
+    PROFILE_PHASE_SEND,
+    PROFILE_PHASE_UPDATE,
+
+    PROFILE_PHASE_COUNT
+};
+
+static const char *ProfilePhaseNames[PROFILE_PHASE_COUNT] = { "receive", "simulate", "send", "update" };
+
+struct PhaseStats {
+    float32 p50;
+    float32 p99;
+    float32 max;
+};
+
+// answer to a STATS request, everything since the server last printed its report.
+// Phase times are in seconds of work per tick
+struct StatsPacket {
+    float32 window;
+    uint32 tickCount;
+    PhaseStats phases[PROFILE_PHASE_COUNT];
+    uint32 packetsIn;
+    uint32 packetsOut;
+    uint32 bytesIn;
+    uint32 bytesOut;
+    uint32 actions;
+    uint32 actionHits;
+    int32 tickRate;
+    int32 clientCount;
+    int32 entityCount;
+};
+
+BitStream PacketBegin(void *buffer, int32 bufferSize);
+int32 PacketEnd(BitStream *stream);
+bool PacketOpen(void *buffer, int32 receivedBytes, BitStream *outStream);
+
+int32 WriteConnectPacket(void *buffer, PacketType type, uint32 cookie);
+int32 WriteKeepalivePacket(void *buffer, int32 bufferSize, uint32 uid);
+int32 WriteWelcomePacket(void *buffer, int32 bufferSize, WelcomePacket *welcome);
+void ReadWelcomePacket(BitStream *stream, WelcomePacket *welcome);
+BitStream BeginInputPacket(void *buffer, int32 bufferSize, Connection *connection, float64 time, uint32 uid,
+                           uint32 ackTick, float32 interpolationDelay, uint32 inputSequence, int32 samplesCount);
+void WriteInputSample(BitStream *stream, float32 inputX, float32 inputY, bool action);
+void WriteStateHeader(BitStream *stream, StateHeader *header);
+void ReadStateHeader(BitStream *stream, StateHeader *header);
+int32 WriteStatsPacket(void *buffer, int32 bufferSize, StatsPacket *stats);
+void ReadStatsPacket(BitStream *stream, StatsPacket *stats);
+void PrintStatsPacket(StatsPacket *stats);
+int32 InputRedundancy(float32 packetLoss);
@@ -5,7 +5,34 @@
 //  Created by Manuel Cabrerizo on 13/02/2024.
 //
 
-void ServerInitialize(Memory *memory) {
+// Length of a tick in nanoseconds, the shard scheduler uses the same value
+uint64 ServerTickInterval(int32 tickRate) {
+    return 1000000000ULL / (uint64)tickRate;
+}
+
+// Bytes of the client map tables for maxClients clients. The map doubles at 3/4 load and
+// keeps the tables it outgrew in the arena, all of them add up to less than twice the last
+size_t ServerClientMapSize(uint32 maxClients) {
+    size_t capacity = InitialClientMapSize;
+    while(maxClients * HashMapMaxLoadDenominator > capacity * HashMapMaxLoadNumerator) {
+        capacity *= 2;
+    }
+    return 2 * capacity * sizeof(HashMap<SlotHandle>::HashElement);
+}
+
+size_t ServerClientArenaSize(ServerConfig *config) {
+    // the clients slot map has an element, a handle, a slot and a generation per client
+    size_t clients = (sizeof(Client) + sizeof(SlotHandle) + 2 * sizeof(uint32)) * config->maxClients;
+    return MB(25) + clients + ServerClientMapSize(config->maxClients) + sizeof(SlotHandle) * config->maxClients;
+}
+
+// Memory a shard needs, most of it is the per client state for config->maxClients
+size_t ServerMemorySize(ServerConfig *config) {
+    size_t perClient = sizeof(SnapshotHistory) + sizeof(EntityPriority) * MaxEntityCount;
+    return sizeof(GameState) + MB(25) + ServerClientArenaSize(config) + MB(10) + perClient * config->maxClients;
+}
+
+void ServerInitialize(Memory *memory, ServerConfig *config) {
     
     ASSERT((memory->used + sizeof(GameState)) <= memory->size);
     
@@ -13,10 +40,13 @@ void ServerInitialize(Memory *memory) {
     memory->used += sizeof(GameState);
 
     gameState->assetsArena = ArenaCreate(memory, MB(25));
-    gameState->clientArena = ArenaCreate(memory, MB(25));
+    gameState->clientArena = ArenaCreate(memory, ServerClientArenaSize(config));
     gameState->packetArena = ArenaCreate(memory, MB(10));
 
-    gameState->entityPool = MemoryPoolCreate(memory, MaxEntityCount, sizeof(Entity));
+    gameState->entities.Initialize(&gameState->clientArena, MaxEntityCount);
+    gameState->maxClients = config->maxClients;
+    gameState->snapshotPool = MemoryPoolCreate(memory, config->maxClients, sizeof(SnapshotHistory));
+    gameState->priorityPool = MemoryPoolCreate(memory, config->maxClients, sizeof(EntityPriority) * MaxEntityCount);
 
     Tilemap collision = LoadCSVTilemap(&gameState->assetsArena, "../assets/tilemaps/collision.csv", 16, 16, true);
     gameState->tilesCountX = collision.width;
@@ -24,183 +54,660 @@ void ServerInitialize(Memory *memory) {
     gameState->tiles = collision.tiles;
 
     // initialize the socket
-    gameState->socket = UDPSocketCreate();
-    gameState->addrs = UDPAddresCreate(IP(127, 0, 0, 1), 35000);
+    gameState->addrs = UDPAddresCreate(IP(127, 0, 0, 1), config->port);
+    gameState->shardIndex = config->shardIndex;
+    // uid 0 marks the empty slots of the lag history
+    gameState->nextEntityUID = 1;
+
+    memset(&gameState->journal, 0, sizeof(Journal));
+    if(config->replayPath) {
+        // the replay gets its datagrams from the journal and what we send goes nowhere
+        gameState->socket = UDPSocketCreateNull();
+        JournalOpenReplay(&gameState->journal, config->replayPath);
+    }
+    else {
+        gameState->socket = UDPSocketCreate();
+        if(config->shardCount > 1) {
+            UDPSocketSetReusePort(&gameState->socket);
+        }
+        UDPSocketBind(&gameState->socket, &gameState->addrs);
+        UDPSocketSetNonBlockingMode(&gameState->socket, true);
+        if(NetworkSimulatorConfigIsActive(&config->simulator)) {
+            NetworkSimulator *simulator = NetworkSimulatorCreate(&gameState->clientArena, config->simulator, SimulatorQueueCapacity);
+            UDPSocketSetSimulator(&gameState->socket, simulator);
+        }
+        if(config->recordPath) {
+            // every shard gets its own journal
+            char path[512];
+            if(config->shardCount > 1) {
+                snprintf(path, sizeof(path), "%s.%d", config->recordPath, config->shardIndex);
+            }
+            else {
+                snprintf(path, sizeof(path), "%s", config->recordPath);
+            }
+            JournalOpenRecord(&gameState->journal, path, config);
+        }
+    }
+
+    // the clients live in a slot map and the hashmap finds them by address, it grows with
+    // the clients up to maxClients
+    gameState->clients.Initialize(&gameState->clientArena, config->maxClients);
+    gameState->clientsMap.Initialize(&gameState->clientArena, InitialClientMapSize, true);
+    gameState->timedOutClients = ArenaPushArray(&gameState->clientArena, config->maxClients, SlotHandle);
+
+    gameState->worldEntities = ArenaPushArray(&gameState->clientArena, MaxEntityCount, EntitySnapshot);
+    gameState->worldEntitySlots = ArenaPushArray(&gameState->clientArena, MaxEntityCount, int32);
+    gameState->candidates = ArenaPushArray(&gameState->clientArena, MaxEntityCount, int32);
+    gameState->candidatePriorities = ArenaPushArray(&gameState->clientArena, MaxEntityCount, float32);
+    gameState->worldEntityCount = 0;
+
+    gameState->interestRadius = config->interestRadius;
+    if(gameState->interestRadius > 0) {
+        InterestGridInitialize(&gameState->interestGrid, &gameState->clientArena,
+                               gameState->tilesCountX, gameState->tilesCountY, gameState->interestRadius);
+    }
+    gameState->challengeSecret = config->challengeSecret;
+
+    gameState->tick = 0;
+    gameState->tickRate = config->tickRate;
+    gameState->tickDt = 1.0f / (float32)config->tickRate;
+    gameState->tickInterval = ServerTickInterval(config->tickRate);
+    gameState->tickAccumulator = 0;
+    gameState->ticksPerSnapshot = Max(1, config->tickRate / config->snapshotRate);
+    gameState->snapshotRate = config->tickRate / gameState->ticksPerSnapshot;
+    gameState->clientBandwidth = config->clientBandwidth;
+
+    // one frame more than the compensation window so the oldest tick can be interpolated
+    int32 lagFrameCount = (int32)ceilf(MaxLagCompensation * config->tickRate) + 2;
+    LagHistoryInitialize(&gameState->lagHistory, &gameState->clientArena, lagFrameCount, MaxEntityCount);
+
+    gameState->time = 0;
+    gameState->lastConnectionReport = 0;
+    ProfilerInitialize(&gameState->profiler, gameState->time);
+}
+
+void ServerSendWelcome(GameState *gameState, uint32 uid, UDPAddress address) {
+    char sendBuffer[1200];
+    WelcomePacket welcome;
+    welcome.uid = uid;
+    welcome.tick = gameState->tick;
+    welcome.tickRate = gameState->tickRate;
+    welcome.shardIndex = gameState->shardIndex;
+    int32 packetSize = WriteWelcomePacket(sendBuffer, 1200, &welcome);
+    int32 sentBytes = UDPSocketSendTo(&gameState->socket, sendBuffer, packetSize, &address);
+    if (sentBytes != packetSize) {
+        printf("failed to send Welcome packet\n");
+    }
+    else {
+        ProfilerCountSent(&gameState->profiler, packetSize);
+        printf("Welcome Packet send\n");
+    }
+}
+
+uint32 ServerChallengeCookie(GameState *gameState, UDPAddress address, uint32 window) {
+    struct {
+        UDPAddress address;
+        uint32 window;
+    } key;
+    memset(&key, 0, sizeof(key));
+    key.address = address;
+    key.window = window;
+    return MurMur2(&key, sizeof(key), gameState->challengeSecret);
+}
+
+// The cookie is not stored anywhere, a hello flood costs us a hash and a packet the
+// same size as the hello
+void ServerSendChallenge(GameState *gameState, UDPAddress address) {
+    uint32 window = (uint32)(gameState->time / ChallengeWindow);
+    char sendBuffer[64];
+    BitStream outStream = PacketBegin(sendBuffer, 64);
+    BitStreamWriteInt(&outStream, PACKET_TYPE_CHALLENGE, 0, PACKET_TYPE_COUNT - 1);
+    BitStreamWriteBits(&outStream, ServerChallengeCookie(gameState, address, window), 32);
+    int32 packetSize = PacketEnd(&outStream);
+    if(UDPSocketSendTo(&gameState->socket, sendBuffer, packetSize, &address) == packetSize) {
+        ProfilerCountSent(&gameState->profiler, packetSize);
+    }
+}
+
+void ServerGetStats(GameState *gameState, StatsPacket *stats) {
+    ProfilerGetStats(&gameState->profiler, gameState->time, stats);
+    stats->tickRate = gameState->tickRate;
+    stats->clientCount = gameState->clients.count;
+    stats->entityCount = (int32)GetEntityCount(gameState);
+}
+
+// Answer a stats request, used by the load generator to watch the server while it runs
+void ServerSendStats(GameState *gameState, UDPAddress address) {
+    StatsPacket stats;
+    ServerGetStats(gameState, &stats);
+    char sendBuffer[MaxDatagramSize];
+    int32 packetSize = WriteStatsPacket(sendBuffer, MaxDatagramSize, &stats);
+    if(UDPSocketSendTo(&gameState->socket, sendBuffer, packetSize, &address) == packetSize) {
+        ProfilerCountSent(&gameState->profiler, packetSize);
+    }
+}
+
+bool ServerCheckChallengeCookie(GameState *gameState, UDPAddress address, uint32 cookie) {
+    uint32 window = (uint32)(gameState->time / ChallengeWindow);
+    return cookie == ServerChallengeCookie(gameState, address, window) ||
+           (window > 0 && cookie == ServerChallengeCookie(gameState, address, window - 1));
+}
+
+// The client takes the uid of its player entity, so no two clients share one
+Client *ServerAddClient(GameState *gameState, UDPAddress address) {
+    SlotHandle handle = gameState->clients.Add();
+    Client *client = gameState->clients.Get(handle);
+    Entity *entity = CreatePlayer(gameState);
+    entity->address = address;
+    client->handle = handle;
+    client->uid = entity->uid;
+    client->address = address;
+    client->lastHeardTime = gameState->time;
+    client->entity = entity->handle;
+    client->snapshots = (SnapshotHistory *)MemoryPoolAlloc(&gameState->snapshotPool);
+    SnapshotHistoryClear(client->snapshots);
+    client->priorities = (EntityPriority *)MemoryPoolAlloc(&gameState->priorityPool);
+    memset(client->priorities, 0, sizeof(EntityPriority) * MaxEntityCount);
+    ConnectionInitialize(&client->connection);
+    gameState->clientsMap.Add(UDPAddressKey(&address), handle);
+    printf("Client Added\n");
+    return client;
+}
 
-    UDPSocketBind(&gameState->socket, &gameState->addrs);
-    UDPSocketSetNonBlockingMode(&gameState->socket, true);
+// Free everything the client holds, its entity, pool blocks, slot and hash slot. The
+// last client moves in its place, pointers to clients are not good after this
+void ServerRemoveClient(GameState *gameState, Client *client) {
+    RemoveEntity(gameState, client->entity);
+    MemoryPoolRelease(&gameState->snapshotPool, client->snapshots);
+    MemoryPoolRelease(&gameState->priorityPool, client->priorities);
+    gameState->clientsMap.Remove(UDPAddressKey(&client->address));
+    gameState->clients.Remove(client->handle);
+    printf("Client Removed\n");
+}
+
+// nullptr if there is no client at that address
+Client *ServerFindClient(GameState *gameState, UDPAddress address) {
+    SlotHandle *handle = gameState->clientsMap.GetPtr(UDPAddressKey(&address));
+    return handle ? gameState->clients.Get(*handle) : nullptr;
+}
+
+// Find the client a packet comes from and mark it as heard
+Client *ServerGetClient(GameState *gameState, uint32 uid, UDPAddress fromAddress) {
+    Client *client = ServerFindClient(gameState, fromAddress);
+    if(client == nullptr || client->uid != uid) {
+        return nullptr;
+    }
+    client->lastHeardTime = gameState->time;
+    return client;
+}
+
+// Drop the clients we haven't heard from in ConnectionTimeout seconds
+void ServerCheckTimeouts(GameState *gameState) {
+    // removing a client moves the last one in its place, find them all first
+    SlotHandle *timedOut = gameState->timedOutClients;
+    uint32 timedOutCount = 0;
+    for(uint32 i = 0; i < gameState->clients.count; ++i) {
+        Client *client = gameState->clients.elements + i;
+        if(gameState->time - client->lastHeardTime > ConnectionTimeout && timedOutCount < gameState->maxClients) {
+            timedOut[timedOutCount++] = client->handle;
+        }
+    }
+    for(uint32 i = 0; i < timedOutCount; ++i) {
+        Client *client = gameState->clients.Get(timedOut[i]);
+        printf("client %u timed out\n", client->uid);
+        ServerRemoveClient(gameState, client);
+    }
+}
+
+void ServerProcessPacket(GameState *gameState, void *buffer, int32 size, UDPAddress fromAddress) {
+    BitStream inStream;
+    if(PacketOpen(buffer, size, &inStream)) {
+        int32 type = BitStreamReadInt(&inStream, 0, PACKET_TYPE_COUNT - 1);
+
+        if(type == PACKET_TYPE_HELLO) {
+            if(size >= MinConnectPacketSize) {
+                ServerSendChallenge(gameState, fromAddress);
+            }
+        }
+        else if(type == PACKET_TYPE_RESPONSE) {
+            uint32 cookie = BitStreamReadBits(&inStream, 32);
+            if(size < MinConnectPacketSize || inStream.overflow || !ServerCheckChallengeCookie(gameState, fromAddress, cookie)) {
+                return;
+            }
+            Client *client = ServerFindClient(gameState, fromAddress);
+            if(client == nullptr) {
+                if(gameState->clients.count >= gameState->maxClients) {
+                    printf("server full, client refused\n");
+                    return;
+                }
+                client = ServerAddClient(gameState, fromAddress);
+            }
+            // the welcome can get lost, answer every valid response
+            client->lastHeardTime = gameState->time;
+            ServerSendWelcome(gameState, client->uid, fromAddress);
+        }
+        else if(type == PACKET_TYPE_INPUT) {
+            // When we recive an input packet we put it in the packet queue to be process later in the frame 
+            PacketInput packet;
+            packet.header = PacketHeader;
+            packet.type = type;
+            ConnectionHeader connectionHeader;
+            ConnectionReadHeader(&inStream, &connectionHeader);
+            packet.uid = BitStreamReadBits(&inStream, 32);
+            packet.tick = BitStreamReadBits(&inStream, 32);
+            packet.interpolationDelay = (float32)BitStreamReadInt(&inStream, 0, MaxReportedInterpolationDelay) / 1000.0f;
+            packet.inputSequence = BitStreamReadBits(&inStream, 32);
+            packet.samplesCount = BitStreamReadInt(&inStream, 0, MaxInputSampleCount);
+            for(int32 i = 0; i < packet.samplesCount; ++i) {
+                InputState *sample = packet.samples + i;
+                *sample = {};
+                sample->sequence = packet.inputSequence - i;
+                sample->inputX = (float32)BitStreamReadInt(&inStream, -1, 1);
+                sample->inputY = (float32)BitStreamReadInt(&inStream, -1, 1);
+                sample->action = BitStreamReadBool(&inStream);
+            }
 
-    // initialize the client hashmap
-    gameState->clientsMap.Initialize(&gameState->clientArena, 128);
-    gameState->clientCount = 0;
+            if(inStream.overflow) {
+                printf("bad Input packet\n");
+                return;
+            }
+            Client *client = ServerGetClient(gameState, packet.uid, fromAddress);
+            if(client && ConnectionProcessHeader(&client->connection, &connectionHeader, gameState->time)) {
+                packet.client = client->handle;
+                gameState->framePackets[gameState->framePacketCount++] = packet;
+            }
+        }
+        else if(type == PACKET_TYPE_KEEPALIVE) {
+            uint32 uid = BitStreamReadBits(&inStream, 32);
+            if(!inStream.overflow) {
+                ServerGetClient(gameState, uid, fromAddress);
+            }
+        }
+        else if(type == PACKET_TYPE_STATS) {
+            if(size >= MinConnectPacketSize) {
+                ServerSendStats(gameState, fromAddress);
+            }
+        }
+    }
+    else {
+        printf("bad Packet\n");
+    }
+}
 
+void ServerSendDatagrams(GameState *gameState, UDPDatagram *datagrams, int32 count) {
+    int32 sentCount = UDPSocketSendBatch(&gameState->socket, datagrams, count);
+    if(sentCount != count) {
+        printf("failed to send State packet\n");
+    }
+    for(int32 i = 0; i < sentCount; ++i) {
+        ProfilerCountSent(&gameState->profiler, datagrams[i].length);
+    }
+}
 
-    gameState->timePassFromLastInputPacket = 0;
+// How much priority an entity gains every snapshot it is not sent, entities closer to the
+// owner, that moved or that the client doesn't have yet go first
+float32 ServerEntityPriority(EntitySnapshot *entity, EntitySnapshot *owner, Snapshot *previous) {
+    float32 distance = Len(entity->pos - owner->pos);
+    float32 priority = 1.0f / (1.0f + distance * PriorityDistanceScale);
+    EntitySnapshot *known = previous ? SnapshotFind(previous, entity->uid) : nullptr;
+    if(known == nullptr) {
+        priority *= PriorityNewBoost;
+    }
+    else if(memcmp(&known->pos, &entity->pos, sizeof(Vec2)) != 0 || memcmp(&known->vel, &entity->vel, sizeof(Vec2)) != 0) {
+        priority *= PriorityMotionBoost;
+    }
+    return priority;
 }
 
-void ServerUpdate(Memory *memory, float32 dt) {
+// Send every client the entities it is interested in as a delta against the last
+// snapshot it acknowledged
+void ServerSendState(GameState *gameState) {
+    UDPDatagram datagrams[MaxDatagramBatchCount];
+
+    // quantize the world once, store the values the client will see after quantization
+    // so the delta compares what was actually sent
+    gameState->worldEntityCount = 0;
+    for(uint32 i = 0; i < gameState->entities.count; ++i) {
+        Entity *entity = gameState->entities.elements + i;
+        EntitySnapshot *entitySnapshot = gameState->worldEntities + gameState->worldEntityCount++;
+        entitySnapshot->uid = entity->uid;
+        entitySnapshot->pos = QuantizeVec2(entity->pos, QuantizedPositionMin, QuantizedPositionMax, QuantizedPositionBits);
+        entitySnapshot->vel = QuantizeVec2(entity->vel, QuantizedVelocityMin, QuantizedVelocityMax, QuantizedVelocityBits);
+        entity->snapshotIndex = gameState->worldEntityCount - 1;
+        gameState->worldEntitySlots[entity->snapshotIndex] = GetEntityIndex(gameState, entity);
+    }
+
+    bool useInterest = gameState->interestRadius > 0;
+    if(useInterest) {
+        InterestGridBuild(&gameState->interestGrid, gameState->worldEntities, gameState->worldEntityCount);
+    }
+
+    int32 datagramCount = 0;
+    for(uint32 i = 0; i < gameState->clients.count; ++i) {
+        Client *client = gameState->clients.elements + i;
+        SnapshotHistory *history = client->snapshots;
+        uint32 slot = gameState->tick % SnapshotHistoryCount;
+
+        Snapshot *baseline = SnapshotHistoryGet(history, client->lastReceivedTick);
+        // the new snapshot goes in the same slot, the baseline is too old to use
+        if(baseline && (baseline->id % SnapshotHistoryCount) == slot) {
+            baseline = nullptr;
+        }
+        Snapshot *previous = SnapshotHistoryGet(history, client->lastSentTick);
+        if(previous && (previous->id % SnapshotHistoryCount) == slot) {
+            previous = nullptr;
+        }
+
+        // every entity relevant to the client, the owner always goes first
+        int32 *candidates = gameState->candidates;
+        int32 candidateCount = 0;
+        int32 ownerIndex = GetEntity(gameState, client->entity)->snapshotIndex;
+        if(useInterest) {
+            candidateCount = InterestGather(&gameState->interestGrid, gameState->worldEntities, ownerIndex,
+                                            gameState->interestRadius, gameState->interestRadius * InterestLeaveFactor,
+                                            previous, candidates, MaxEntityCount);
+        }
+        else {
+            candidates[candidateCount++] = ownerIndex;
+            for(int32 j = 0; j < gameState->worldEntityCount; ++j) {
+                if(j != ownerIndex) {
+                    candidates[candidateCount++] = j;
+                }
+            }
+        }
+        // every relevant entity accumulates priority until it is sent, so the ones that don't
+        // fit in the snapshot or in this packet are more likely to make it in the next one
+        EntitySnapshot *owner = gameState->worldEntities + ownerIndex;
+        float32 *candidatePriorities = gameState->candidatePriorities;
+        for(int32 j = 0; j < candidateCount; ++j) {
+            int32 candidate = candidates[j];
+            EntitySnapshot *entitySnapshot = gameState->worldEntities + candidate;
+            EntityPriority *priority = client->priorities + gameState->worldEntitySlots[candidate];
+            if(priority->uid != entitySnapshot->uid) {
+                // the slot belonged to another entity
+                priority->uid = entitySnapshot->uid;
+                priority->accumulator = 0;
+            }
+            if(candidate == ownerIndex) {
+                candidatePriorities[candidate] = SnapshotMaxPriority;
+            }
+            else {
+                priority->accumulator += ServerEntityPriority(entitySnapshot, owner, previous);
+                candidatePriorities[candidate] = priority->accumulator;
+            }
+        }
+        // the snapshot holds the ones with the highest priority
+        if(candidateCount > MaxSnapshotEntityCount) {
+            std::nth_element(candidates, candidates + MaxSnapshotEntityCount - 1, candidates + candidateCount,
+                             [candidatePriorities](int32 a, int32 b) { return candidatePriorities[a] > candidatePriorities[b]; });
+            candidateCount = MaxSnapshotEntityCount;
+        }
+
+        // snapshots are sorted by uid
+        for(int32 j = 1; j < candidateCount; ++j) {
+            int32 candidate = candidates[j];
+            uint32 uid = gameState->worldEntities[candidate].uid;
+            int32 k = j - 1;
+            while(k >= 0 && gameState->worldEntities[candidates[k]].uid > uid) {
+                candidates[k + 1] = candidates[k];
+                --k;
+            }
+            candidates[k + 1] = candidate;
+        }
+
+        Snapshot *current = SnapshotHistoryInsert(history, gameState->tick);
+        float32 priorities[MaxSnapshotEntityCount];
+        EntityPriority *entityPriorities[MaxSnapshotEntityCount];
+        for(int32 j = 0; j < candidateCount; ++j) {
+            int32 candidate = candidates[j];
+            current->entities[j] = gameState->worldEntities[candidate];
+            priorities[j] = candidatePriorities[candidate];
+            entityPriorities[j] = client->priorities + gameState->worldEntitySlots[candidate];
+        }
+        current->entityCount = candidateCount;
+        client->lastSentTick = gameState->tick;
+
+        // the bandwidth budget fills at clientBandwidth bytes per second and each state packet
+        // spends what it sends, unused budget carries over up to one extra packet
+        int32 packetBudget = MaxDatagramSize;
+        if(gameState->clientBandwidth > 0) {
+            float32 snapshotBytes = gameState->clientBandwidth / (float32)gameState->snapshotRate;
+            client->bandwidthCredit = Min(client->bandwidthCredit + snapshotBytes, snapshotBytes * 2.0f);
+            packetBudget = Min(Max((int32)client->bandwidthCredit, MinStatePacketSize), MaxDatagramSize);
+        }
+
+        uint8 *sendBuffer = gameState->sendBuffers[datagramCount];
+        BitStream outStream = PacketBegin(sendBuffer, packetBudget);
+        BitStreamWriteInt(&outStream, PACKET_TYPE_STATE, 0, PACKET_TYPE_COUNT - 1);
+        ConnectionWriteHeader(&client->connection, &outStream, gameState->time);
+        StateHeader stateHeader;
+        stateHeader.tick = gameState->tick;
+        stateHeader.baselineDistance = baseline ? gameState->tick - baseline->id : 0;
+        // the client replays the inputs after this one
+        stateHeader.lastAppliedInput = client->lastAppliedInput;
+        WriteStateHeader(&outStream, &stateHeader);
+        bool upToDate[MaxSnapshotEntityCount];
+        SnapshotWriteDelta(&outStream, baseline, current, priorities, upToDate);
+
+        for(int32 j = 0; j < candidateCount; ++j) {
+            if(upToDate[j]) {
+                entityPriorities[j]->accumulator = 0;
+            }
+        }
+
+        UDPDatagram *datagram = datagrams + datagramCount++;
+        datagram->data = sendBuffer;
+        datagram->length = PacketEnd(&outStream);
+        datagram->address = client->address;
+        client->bandwidthCredit -= datagram->length;
+
+        if(datagramCount == MaxDatagramBatchCount) {
+            ServerSendDatagrams(gameState, datagrams, datagramCount);
+            datagramCount = 0;
+        }
+    }
+
+    if(datagramCount > 0) {
+        ServerSendDatagrams(gameState, datagrams, datagramCount);
+    }
+}
+
+// Advance the simulation one fixed step of tickDt seconds
+void ServerTick(GameState *gameState) {
+    ProfilerBegin(&gameState->profiler, PROFILE_PHASE_SIMULATE);
+    for(uint32 i = 0; i < gameState->clients.count; ++i) {
+        Client *client = gameState->clients.elements + i;
+        Entity *entity = GetEntity(gameState, client->entity);
+        // apply one input per tick, the same step the client predicted with it. If the
+        // input didn't arrive the player doesn't move and the client gets corrected
+        if(client->newestInput == client->lastAppliedInput) {
+            entity->vel = Vec2(0, 0);
+            continue;
+        }
+        if(client->newestInput - client->lastAppliedInput > MaxInputBacklog) {
+            client->lastAppliedInput = client->newestInput - MaxInputBacklog;
+        }
+        uint32 sequence = client->lastAppliedInput + 1;
+        InputState *input = client->inputs + (sequence % InputBufferSize);
+        if(input->sequence == sequence) {
+            SimulatePlayer(gameState, entity, input->inputX, input->inputY, gameState->tickDt);
+            // act when the button goes down, not every tick it is held
+            if(input->action && !client->actionHeld) {
+                ServerClientInteract(gameState, client, entity);
+            }
+            client->actionHeld = input->action;
+        }
+        else {
+            entity->vel = Vec2(0, 0);
+        }
+        client->lastAppliedInput = sequence;
+    }
+
+    gameState->tick++;
+    // the positions after the step are the state of the new tick, the one the snapshots carry
+    LagHistoryRecord(&gameState->lagHistory, gameState);
+    ProfilerEnd(&gameState->profiler, PROFILE_PHASE_SIMULATE);
+
+    if((gameState->tick % gameState->ticksPerSnapshot) == 0) {
+        ProfilerBegin(&gameState->profiler, PROFILE_PHASE_SEND);
+        ServerSendState(gameState);
+        ProfilerEnd(&gameState->profiler, PROFILE_PHASE_SEND);
+    }
+}
+
+void ServerReportConnections(GameState *gameState) {
+    for(uint32 i = 0; i < gameState->clients.count; ++i) {
+        Client *client = gameState->clients.elements + i;
+        Connection *connection = &client->connection;
+        printf("client %u rtt: %.1fms jitter: %.1fms loss: %.1f%% sent: %u received: %u acked: %u lost: %u\n",
+               client->uid, connection->rtt * 1000.0f, connection->jitter * 1000.0f, connection->packetLoss * 100.0f,
+               connection->sentCount, connection->receivedCount, connection->ackedCount, connection->lostCount);
+    }
+    NetworkSimulator *simulator = gameState->socket.simulator;
+    if(simulator) {
+        printf("simulator dropped: %u duplicated: %u reordered: %u overflow: %u\n", simulator->droppedCount,
+               simulator->duplicatedCount, simulator->reorderedCount, simulator->overflowCount);
+    }
+
+    StatsPacket stats;
+    ServerGetStats(gameState, &stats);
+    printf("shard %d ", gameState->shardIndex);
+    PrintStatsPacket(&stats);
+    ProfilerReset(&gameState->profiler, gameState->time);
+}
+
+// dt is the time since the previous update in nanoseconds
+void ServerUpdate(Memory *memory, uint64 dt) {
     GameState *gameState = (GameState *)memory->data;
+    gameState->time += (float64)dt / 1000000000.0;
+    ProfilerBegin(&gameState->profiler, PROFILE_PHASE_UPDATE);
+    bool recording = gameState->journal.file && !gameState->journal.replaying;
+    if(recording) {
+        JournalWriteUpdate(&gameState->journal, dt, gameState->tick);
+    }
+    ProfilerBegin(&gameState->profiler, PROFILE_PHASE_RECEIVE);
 
     ArenaClear(&gameState->packetArena); 
     gameState->framePackets = (PacketInput *)ArenaPushSize(&gameState->packetArena, gameState->packetArena.size);
     gameState->framePacketCount = 0;
 
-    char buffer[1200];
+    UDPDatagram datagrams[MaxDatagramBatchCount];
 
 	UDPAddress fromAddress;
     memset(&fromAddress, 0, sizeof(UDPAddress));
 	//keep reading until we don't have anything to read ( or we hit a max number that we'll process per frame )
+    // every UDPSocketReceiveBatch call reads up to MaxDatagramBatchCount packets with one syscall
 	int32 receivedPackedCount = 0;
 	int32 totalReadByteCount = 0;
 
 	while( receivedPackedCount < MaxPacketPerFrameCount ) {
-		int32 readByteCount = UDPSocketReceiveFrom(&gameState->socket, buffer, 1200, &fromAddress);
-		if( readByteCount == 0 ) {
+        int32 batchCount = Min(MaxDatagramBatchCount, (int32)MaxPacketPerFrameCount - receivedPackedCount);
+        for(int32 i = 0; i < batchCount; ++i) {
+            datagrams[i].data = gameState->receiveBuffers[i];
+            datagrams[i].length = MaxDatagramSize;
+        }
+
+		int32 readPacketCount = gameState->journal.replaying ?
+            JournalReadDatagrams(&gameState->journal, datagrams, batchCount) :
+            UDPSocketReceiveBatch(&gameState->socket, datagrams, batchCount);
+		if( readPacketCount == 0 ) {
 			//nothing to read
 			break;
 		}
-		else if( readByteCount == -WSAECONNRESET ) {
+		else if( readPacketCount == -WSAECONNRESET ) {
 			//port closed on other end, so DC this person immediately
-            uint32 uid = MurMur2(&fromAddress, sizeof(UDPAddress), 123);
-            Client *client = gameState->clientsMap.GetPtr(uid);
+            Client *client = ServerFindClient(gameState, fromAddress);
             if(client) {
-                RemoveEntity(gameState, client->entity);
-                gameState->clientsMap.Remove(uid);
-                gameState->clientCount--;
+                ServerRemoveClient(gameState, client);
             }
 		}
-		else if( readByteCount > 0 ) {
-            // TODO: create a function to handle the input packets
-            MemoryStream inStream = MemoryStreamCreate(buffer, 1200);
-            int32 header;
-            MemoryStreamRead(&inStream, &header, sizeof(int32)); 
-            if(header == PacketHeader) {
-                int32 type;
-                MemoryStreamRead(&inStream, &type, sizeof(int32));  
-
-                if(type == PacketTypeHello) {
-                    printf("Hello packet recived\n");
-                    uint32 uid = MurMur2(&fromAddress, sizeof(UDPAddress), 123);
-                    Client *client = gameState->clientsMap.GetPtr(uid);
-                    // check if we already process the hello packet
-                    if(client == nullptr) {
-                        // we have to add the new client
-                        Client newClient;
-                        newClient.uid = uid;
-                        newClient.address = fromAddress;
-                        newClient.entity = CreatePlayer(gameState);
-                        newClient.entity->uid = uid;
-                        newClient.entity->address = fromAddress;
-                        gameState->clientsMap.Add(uid, newClient);
-                        gameState->clientCount++;
-                        printf("Client Added\n");
-                    }
-                    // send welcome packet
-                    char sendBuffer[1200];
-                    UDPAddress toSendAddr = fromAddress;
-                    MemoryStream outStream = MemoryStreamCreate(sendBuffer, 1200);
-                    MemoryStreamWrite(&outStream, (void *)&PacketHeader, sizeof(int32));
-                    MemoryStreamWrite(&outStream, (void *)&PacketTypeWelcome, sizeof(int32));
-                    MemoryStreamWrite(&outStream, (void *)&uid, sizeof(uint32));
-                    int32 sentBytes = UDPSocketSendTo(&gameState->socket, sendBuffer, 1200, &toSendAddr);
-                    if (sentBytes != 1200) {
-                        printf("failed to send Welcome packet\n");
-                    }
-                    else {
-                        printf("Welcome Packet send\n");
-                    }
-                }
-                else if(type == PacketTypeState) {
-                    // When we recive a state packet we put it in the packet queue to be process later in the frame 
-                    uint32 networkID;
-                    MemoryStreamRead(&inStream, &networkID, sizeof(uint32));
-
-                    int32 inputSampleCount;
-                    MemoryStreamRead(&inStream, &inputSampleCount, sizeof(int32));
-
-                    InputState inputStates[3];
-                    MemoryStreamRead(&inStream, &inputStates[0], sizeof(InputState));
-                    MemoryStreamRead(&inStream, &inputStates[1], sizeof(InputState));
-                    MemoryStreamRead(&inStream, &inputStates[2], sizeof(InputState));
-
-                    PacketInput packet;
-                    packet.header = header;
-                    packet.type = type;
-                    packet.uid = networkID;
-                    packet.samplesCount = inputSampleCount;
-                    packet.samples[0] = inputStates[0];
-                    packet.samples[1] = inputStates[1];
-                    packet.samples[2] = inputStates[2];
-
-                    gameState->framePackets[gameState->framePacketCount++] = packet;
+		else if( readPacketCount > 0 ) {
+            for(int32 i = 0; i < readPacketCount; ++i) {
+                if(recording) {
+                    JournalWriteDatagram(&gameState->journal, datagrams + i);
                 }
+                fromAddress = datagrams[i].address;
+                ProfilerCountReceived(&gameState->profiler, datagrams[i].length);
+                ServerProcessPacket(gameState, datagrams[i].data, datagrams[i].length, fromAddress);
+                totalReadByteCount += datagrams[i].length;
             }
-            else {
-                printf("bad Packet\n");
-            }
-
-
-			++receivedPackedCount;
-			totalReadByteCount += readByteCount;
+			receivedPackedCount += readPacketCount;
 		}
 		else {
-			//uhoh, error? exit or just keep going?
+			//uhoh, error? stop reading for this frame
+            break;
 		}
 	}
 
 
-    // TODO: update the game state of the server
-    // TODO: send the new game state to our clients 
+    // buffer the inputs we haven't applied yet, the simulation applies one every tick
     for(int32 i = 0; i < gameState->framePacketCount; ++i) {
         PacketInput *packet = gameState->framePackets + i;
 
-        Client *client = gameState->clientsMap.GetPtr(packet->uid);
-        for(int32 j = packet->samplesCount - 1; j >= 0; --j) {
-            InputState inputState = packet->samples[j]; 
-            client->entity->vel = inputState.vel;
-            MoveEntity(gameState, client->entity, inputState.inputX, inputState.inputY, inputState.deltaTime);
+        Client *client = gameState->clients.Get(packet->client);
+        if(client == nullptr) {
+            continue;
+        }
+        for(int32 j = 0; j < packet->samplesCount; ++j) {
+            InputState *sample = packet->samples + j;
+            if(sample->sequence == 0 || (int32)(sample->sequence - client->lastAppliedInput) <= 0 ||
+               sample->sequence - client->lastAppliedInput > (uint32)InputBufferSize) {
+                continue;
+            }
+            client->inputs[sample->sequence % InputBufferSize] = *sample;
+            if((int32)(sample->sequence - client->newestInput) > 0) {
+                client->newestInput = sample->sequence;
+            }
+        }
+        // ignore acks that arrive out of order
+        if((int32)(packet->tick - client->lastReceivedTick) > 0) {
+            client->lastReceivedTick = packet->tick;
+            client->interpolationDelay = packet->interpolationDelay;
         }
-
     }
 
-    if(gameState->timePassFromLastInputPacket > TimeBetweenInputPackets) {
-        // send new state packet
-        char sendBuffer[1200];
-
-        MemoryStream outStream = MemoryStreamCreate(sendBuffer, 1200);
-
-        MemoryStreamWrite(&outStream, (void *)&gameState->clientCount, sizeof(int32));
-
-        Entity *entity = gameState->entities;
-        while(entity) {
-
-            MemoryStreamWrite(&outStream, (void *)&PacketHeader, sizeof(int32));
-            MemoryStreamWrite(&outStream, (void *)&PacketTypeState, sizeof(int32));
-            MemoryStreamWrite(&outStream, (void *)&entity->uid, sizeof(uint32));
-            MemoryStreamWrite(&outStream, (void *)&entity->pos, sizeof(Vec2));
-            MemoryStreamWrite(&outStream, (void *)&entity->vel, sizeof(Vec2));
-            
-            entity = entity->next;
-        }
+    ServerCheckTimeouts(gameState);
+    ProfilerEnd(&gameState->profiler, PROFILE_PHASE_RECEIVE);
 
-        Entity *e = gameState->entities;
-        while(e) {
-            int32 sentBytes = UDPSocketSendTo(&gameState->socket, sendBuffer, 1200, &e->address);
-            if (sentBytes != 1200) {
-                printf("failed to send State packet\n");
-            }
-            e = e->next;
-        }
+    gameState->tickAccumulator += dt;
+    int32 tickCount = 0;
+    while(gameState->tickAccumulator >= gameState->tickInterval && tickCount < MaxTicksPerUpdate) {
+        ServerTick(gameState);
+        gameState->tickAccumulator -= gameState->tickInterval;
+        ++tickCount;
+    }
+    // if we fall too far behind drop the time instead of spiraling, only whole ticks so
+    // the next ones are still due when the scheduler wakes us
+    if(tickCount == MaxTicksPerUpdate) {
+        gameState->tickAccumulator %= gameState->tickInterval;
+    }
+    ProfilerEnd(&gameState->profiler, PROFILE_PHASE_UPDATE);
+    ProfilerFrameEnd(&gameState->profiler, tickCount);
 
-        gameState->timePassFromLastInputPacket -= TimeBetweenInputPackets;
+    if(gameState->time - gameState->lastConnectionReport >= ConnectionReportInterval) {
+        ServerReportConnections(gameState);
+        gameState->lastConnectionReport = gameState->time;
     }
+}
 
-    gameState->timePassFromLastInputPacket += dt;
+// Sleep until a packet arrives or timeout seconds pass, returns true if there is something to read
+bool ServerWaitForPackets(Memory *memory, float32 timeout) {
+    GameState *gameState = (GameState *)memory->data;
+    return UDPSocketWaitForData(&gameState->socket, timeout) > 0;
+}
 
+// The dt of the next update of the journal we are replaying, false when it is over
+bool ServerReplayNextUpdate(Memory *memory, uint64 *outDt) {
+    GameState *gameState = (GameState *)memory->data;
+    if(!gameState->journal.replaying) {
+        return false;
+    }
+    return JournalReadUpdate(&gameState->journal, gameState->tick, outDt);
 }
 
 void ServerShutdown(Memory *memory) {
     GameState *gameState = (GameState *)memory->data;
+    JournalClose(&gameState->journal);
 
     UDPSocketDestroy(&gameState->socket);
 
@@ -66,15 +66,18 @@ struct Entity {
     Vec2 spriteDim;
 
     UDPAddress address;
+    // index in GameState::worldEntities of the last snapshot
+    int32 snapshotIndex;
 
-    Entity *next;
-    Entity *prev;
+    SlotHandle handle;
 };
 
 struct InputState {
+    uint32 sequence;
     Vec2 vel;
     float32 inputX;
     float32 inputY;
+    bool action;
     float32 deltaTime;
     float64 timeStamp;
 };  
@@ -83,15 +86,165 @@ struct PacketInput {
     uint32 header;
     uint32 type;
     uint32 uid;
+    // the client that sent it
+    SlotHandle client;
+    uint32 tick;
+    float32 interpolationDelay;
+    // sequence of samples[0], the other samples are the inputs before it
+    uint32 inputSequence;
     int32 samplesCount;
-    InputState samples[3];
+    InputState samples[MaxInputSampleCount];
 };
 
 
+struct EntityPriority {
+    uint32 uid;
+    float32 accumulator;
+};
+
 struct Client {
+    SlotHandle handle;
     uint32 uid;
     UDPAddress address;
-    Entity *entity;
+    SlotHandle entity;
+    float64 lastHeardTime;
+
+    // inputs recived and not applied yet indexed by sequence, one is applied every tick
+    InputState inputs[InputBufferSize];
+    uint32 newestInput;
+    uint32 lastAppliedInput;
+    // last server tick the client told us it has seen, it is also the id of the
+    // snapshot the client acknowledged and the baseline for the next delta
+    uint32 lastReceivedTick;
+    uint32 lastSentTick;
+    SnapshotHistory *snapshots;
+
+    // indexed by the slot of the entity in the entity slot map
+    EntityPriority *priorities;
+    float32 bandwidthCredit;
+
+    // sequence, acks, rtt and loss of the packets we exchange with the client
+    Connection connection;
+    // how far behind the server the client renders the other entities, with the rtt it
+    // tells us what the client saw when it sent its last input
+    float32 interpolationDelay;
+    // the action button was down in the last input we applied
+    bool actionHeld;
+};
+
+// Positions of every entity for the last ticks to judge the actions of a client against
+// the world it saw. Stored in SoA form, frame f holds slotCount entries starting at
+// f * slotCount indexed by the slot of the entity in the entity slot map
+struct LagHistory {
+    int32 frameCount;
+    int32 slotCount;
+    uint32 newestTick;
+    // tick stored in each frame, frames are reused every frameCount ticks
+    uint32 *ticks;
+    // 0 for the slots that were free in that tick
+    uint32 *uids;
+    float32 *posX;
+    float32 *posY;
+    // slotCount entries LagHistoryRewind fills for the queries
+    uint32 *rewindUids;
+    float32 *rewindX;
+    float32 *rewindY;
+};
+
+enum JournalRecordType {
+    JOURNAL_RECORD_UPDATE = 1,
+    JOURNAL_RECORD_DATAGRAM = 2
+};
+
+// The journal starts with the header and has a record for every ServerUpdate followed by
+// one for every datagram that update received. The records are packed in host byte order:
+// UPDATE type(8) dt(64 nanoseconds) tick(32), DATAGRAM type(8) ip(32) port(16) length(16) data
+struct JournalHeader {
+    uint32 magic;
+    uint32 version;
+    int32 tickRate;
+    int32 snapshotRate;
+    float32 interestRadius;
+    float32 clientBandwidth;
+    uint32 challengeSecret;
+    uint32 maxClients;
+};
+
+struct Journal {
+    FILE *file;
+    bool replaying;
+    // the update record we read while looking for more datagrams of the previous one
+    bool hasPendingUpdate;
+    uint64 pendingDt;
+    uint32 pendingTick;
+
+    uint32 updateCount;
+    uint32 datagramCount;
+    // updates that didn't start at the tick they had when recorded
+    uint32 mismatchCount;
+};
+
+static const int32 ProfileSubBucketCount = 8;
+// up to 2^18 microseconds, slower samples go in the last bucket
+static const int32 ProfileBucketCount = 128;
+
+struct InterestGrid {
+    float32 cellSize;
+    float32 invCellSize;
+    int32 cellCountX;
+    int32 cellCountY;
+    int32 *cellStart;
+    int32 *cellCursor;
+    int32 *entityCells;
+    int32 *entityIndices;
+    int32 entityCount;
+};
+
+// log scale histogram of microseconds, every power of two is split in ProfileSubBucketCount
+// buckets so a percentile is off by at most 1/ProfileSubBucketCount
+struct ProfileHistogram {
+    uint32 buckets[ProfileBucketCount];
+    uint32 count;
+    uint64 max;
+};
+
+struct Profiler {
+    uint64 phaseStart[PROFILE_PHASE_COUNT];
+    // time spent in each phase since the last tick, pushed to the histograms when a tick runs
+    uint64 phaseTime[PROFILE_PHASE_COUNT];
+    ProfileHistogram histograms[PROFILE_PHASE_COUNT];
+
+    // counters since the last report
+    float64 windowStart;
+    uint32 tickCount;
+    uint32 packetsIn;
+    uint32 packetsOut;
+    uint32 bytesIn;
+    uint32 bytesOut;
+    // actions the clients took and entities they reached
+    uint32 actions;
+    uint32 actionHits;
+};
+
+struct ServerConfig {
+    int32 tickRate;
+    int32 snapshotRate;
+    uint16 port;
+    int32 shardCount;
+    int32 shardIndex;
+    // clients only get the entities closer than this, 0 sends everything
+    float32 interestRadius;
+    // bytes per second of state each client can get, 0 means no limit
+    float32 clientBandwidth;
+    uint32 challengeSecret;
+    // clients past this are refused, the per client memory of the shard is sized by it
+    uint32 maxClients;
+    // applied to everything the server sends and receives when any field is set
+    NetworkSimulatorConfig simulator;
+    // journal every received datagram to this file, nullptr to not record
+    const char *recordPath;
+    // run the updates of a journal instead of the network, nullptr for a normal server
+    const char *replayPath;
 };
 
 struct GameState {
@@ -107,21 +260,62 @@ struct GameState {
     CollisionPacket frameCollisions[1024];
     int32 frameCollisionCount;
 
-    // TODO: change this to use a slotmap or something more cache friendly
-    MemoryPool entityPool;
-    Entity *entities;
+    SlotMap<Entity> entities;
 
     UDPSocket socket;
     UDPAddress addrs;
+    uint8 receiveBuffers[MaxDatagramBatchCount][MaxDatagramSize];
+
+    SlotMap<Client> clients;
+    // UDPAddressKey of the client address to the handle of the client in clients
+    HashMap<SlotHandle> clientsMap;
+    uint32 maxClients;
+    // maxClients entries to collect the clients that timed out
+    SlotHandle *timedOutClients;
+
+    MemoryPool snapshotPool;
+    MemoryPool priorityPool;
+    EntitySnapshot *worldEntities;
+    int32 *worldEntitySlots;
+    // scratch of ServerSendState, the relevant entities of a client and their priority by
+    // index of worldEntities
+    int32 *candidates;
+    float32 *candidatePriorities;
+    int32 worldEntityCount;
+    float32 clientBandwidth;
 
-    HashMap<Client> clientsMap;
-    uint32 clientCount;
+    InterestGrid interestGrid;
+    LagHistory lagHistory;
+    float32 interestRadius;
+    uint8 sendBuffers[MaxDatagramBatchCount][MaxDatagramSize];
 
     PacketInput *framePackets;
     int32 framePacketCount;
 
+    int32 shardIndex;
+    uint32 nextEntityUID;
+
+    // challenge cookies are a hash of the client address, the time window and this secret
+    uint32 challengeSecret;
+
+    // seconds since the server started, used to time the connection packets
+    float64 time;
+    float64 lastConnectionReport;
+
+    Profiler profiler;
+    // file is nullptr unless recording or replaying
+    Journal journal;
 
-    float32 timePassFromLastInputPacket;
+    // fixed timestep simulation
+    uint32 tick;
+    int32 tickRate;
+    float32 tickDt;
+    // in nanoseconds, integers so the accumulator and the scheduler of the shard agree
+    // on when a tick is due however long the server runs
+    uint64 tickInterval;
+    uint64 tickAccumulator;
+    int32 ticksPerSnapshot;
+    int32 snapshotRate;
 };
 
 #endif
@@ -130,13 +324,37 @@ struct GameState {
 static const float32 MetersToPixels = 32;
 static const float32 PixelsToMeters = 1.0f / MetersToPixels;
 static const int32 SPRITE_SIZE = 1;
-static const uint32 MaxEntityCount = 1024;
+static const uint32 MaxEntityCount = 4096;
+// every client has a player entity, --max-clients can go up to MaxEntityCount
+static const uint32 DefaultMaxClientCount = 1024;
+// the client map starts this big and doubles as clients join
+static const uint32 InitialClientMapSize = 32;
 
-static const uint32 PacketHeader      = 'PIPE';
-static const uint32 PacketTypeHello   = 'HELO';
-static const uint32 PacketTypeState   = 'STAT';
-static const uint32 PacketTypeWelcome = 'WLCM';
 
-static const float32 TimeBetweenInputPackets = 0.033f;
-static const uint32  MaxPacketPerFrameCount = 10;
+static const uint16  DefaultServerPort = 35000;
+static const int32   DefaultTickRate = 30;
+static const int32   DefaultSnapshotRate = 30;
+static const int32   MaxTicksPerUpdate = 5;
+static const float32 DefaultInterestRadius = 12.0f;
+// how much further than the interest radius an entity has to go to leave
+static const float32 InterestLeaveFactor = 1.25f;
+static const float32 DefaultClientBandwidth = 16 * 1024;
+static const int32   MinStatePacketSize = 64;
+static const float32 PriorityDistanceScale = 0.25f;
+static const float32 PriorityMotionBoost = 2.0f;
+static const float32 PriorityNewBoost = 4.0f;
+static const uint32  MaxPacketPerFrameCount = 256;
+// inputs further ahead than this are dropped so a client that runs fast doesn't build up latency
+static const uint32  MaxInputBacklog = 4;
+static const uint32  JournalMagic = 0x4C4E524A; // JRNL
+static const uint32  JournalVersion = 5;
+static const int32   JournalBufferSize = MB(1);
+// the oldest world state a client can act on, in seconds
+static const float32 MaxLagCompensation = 0.5f;
+// how close in meters an entity has to be for the action of a player to reach it
+static const float32 InteractRange = 1.5f;
+static const float64 ConnectionReportInterval = 10.0;
+// a challenge cookie is valid during the window it was made in and the next one
+static const float64 ChallengeWindow = 10.0;
+static const int32   SimulatorQueueCapacity = 1024;
 
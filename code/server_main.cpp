@@ -1,56 +1,329 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <memory.h>
 #include <chrono>
+#include <thread>
+#include <random>
+#include <algorithm>
 #include <unistd.h>
+#include <signal.h>
 
 
 #include "common.h"
 #include "algebra.h"
 #include "memory.h"
 #include "network.h"
+#include "protocol.h"
+#include "snapshot.h"
 #include "server.h"
 
 #include "memory.cpp"
 #include "network.cpp"
+#include "protocol.cpp"
+#include "snapshot.cpp"
 #include "collision.cpp"
 #include "tilemap.cpp"
 #include "entity.cpp"
+#include "interest.cpp"
+#include "profiler.cpp"
+#include "journal.cpp"
+#include "lagcomp.cpp"
 #include "server.cpp"
 
-int32 main(int32 argc, char **argv) {
+typedef std::chrono::high_resolution_clock::time_point TimePoint;
 
-    // TODO: create a utility file for this kind of functions...
-    // print current working directory
-    const size_t cwdSize = 256;
-    char cwd[cwdSize];
-    getcwd(cwd, cwdSize);
-    printf("cwd: %s\n", cwd);
-    
+struct TickScheduler {
+    int32 shardIndex;
+    // nanoseconds
+    uint64 tickInterval;
+    TimePoint nextTick;
+    TimePoint tickStart;
+
+    // stats since the last report
+    TimePoint lastReport;
+    uint32 tickCount;
+    uint32 overrunCount;
+    uint32 skippedTickCount;
+    uint32 wakeCount;
+    float64 totalLateness;
+    float64 maxLateness;
+    float64 maxTickTime;
+};
+
+static const float64 TickStatsReportInterval = 10.0;
+
+float64 SecondsBetween(TimePoint a, TimePoint b) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(b - a);
+    return (float64)elapsed.count() / 1000000000.0;
+}
+
+// now has to be the time of the first update so the ticks are due when the server
+// accumulated whole tick intervals
+TickScheduler TickSchedulerCreate(uint64 tickInterval, int32 shardIndex, TimePoint now) {
+    TickScheduler scheduler = {};
+    scheduler.shardIndex = shardIndex;
+    scheduler.tickInterval = tickInterval;
+    scheduler.nextTick = now + std::chrono::nanoseconds(tickInterval);
+    scheduler.lastReport = now;
+    return scheduler;
+}
+
+float32 TickSchedulerTimeToNextTick(TickScheduler *scheduler, TimePoint now) {
+    return (float32)SecondsBetween(now, scheduler->nextTick);
+}
+
+// returns true if the tick deadline has passed, otherwise we woke up because of a packet
+bool TickSchedulerBeginTick(TickScheduler *scheduler, TimePoint now) {
+    scheduler->wakeCount++;
+    if(now < scheduler->nextTick) {
+        return false;
+    }
+
+    float64 lateness = SecondsBetween(scheduler->nextTick, now);
+    scheduler->totalLateness += lateness;
+    scheduler->maxLateness = Max(scheduler->maxLateness, lateness);
+    scheduler->tickCount++;
+    scheduler->tickStart = now;
+
+    auto interval = std::chrono::nanoseconds(scheduler->tickInterval);
+    scheduler->nextTick += interval;
+    // if we are more than a full tick behind don't try to catch up, skip the missed ticks
+    while(scheduler->nextTick <= now) {
+        scheduler->nextTick += interval;
+        scheduler->skippedTickCount++;
+    }
+    return true;
+}
+
+void TickSchedulerEndTick(TickScheduler *scheduler, TimePoint now) {
+    float64 tickTime = SecondsBetween(scheduler->tickStart, now);
+    scheduler->maxTickTime = Max(scheduler->maxTickTime, tickTime);
+    if(tickTime > (float64)scheduler->tickInterval / 1000000000.0) {
+        scheduler->overrunCount++;
+    }
+
+    if(SecondsBetween(scheduler->lastReport, now) >= TickStatsReportInterval) {
+        float64 avgLateness = scheduler->tickCount ? scheduler->totalLateness / scheduler->tickCount : 0;
+        printf("shard %d ticks: %u wakes: %u overruns: %u skipped: %u lateness avg: %.3fms max: %.3fms tick max: %.3fms\n",
+               scheduler->shardIndex, scheduler->tickCount, scheduler->wakeCount, scheduler->overrunCount, scheduler->skippedTickCount,
+               avgLateness * 1000.0, scheduler->maxLateness * 1000.0, scheduler->maxTickTime * 1000.0);
+        scheduler->lastReport = now;
+        scheduler->tickCount = 0;
+        scheduler->wakeCount = 0;
+        scheduler->overrunCount = 0;
+        scheduler->skippedTickCount = 0;
+        scheduler->totalLateness = 0;
+        scheduler->maxLateness = 0;
+        scheduler->maxTickTime = 0;
+    }
+}
+
+// cleared by SIGINT / SIGTERM so the shards shut down and flush their journals
+static volatile sig_atomic_t ServerRunning = 1;
+
+void ServerStopSignal(int) {
+    ServerRunning = 0;
+}
+
+void RunShard(ServerConfig config) {
     Memory memory;
-    memory.size = MB(100);
+    memory.size = ServerMemorySize(&config);
     memory.used = 0;
     memory.data = (uint8 *)malloc(memory.size);
 
+    ServerInitialize(&memory, &config);
 
-    ServerInitialize(&memory);
-
+    // The loop sleeps on the socket until a packet arrives or the next tick is due,
+    // so an idle server doesn't burn a core
     auto last = std::chrono::high_resolution_clock::now( );    
-    for(;;) {        
+    TickScheduler scheduler = TickSchedulerCreate(ServerTickInterval(config.tickRate), config.shardIndex, last);
+
+    while(ServerRunning) {        
+        // measure from now, last is from before the previous update ran
+        float32 timeout = TickSchedulerTimeToNextTick(&scheduler, std::chrono::high_resolution_clock::now( ));
+        if(timeout > 0.0f) {
+            ServerWaitForPackets(&memory, timeout);
+        }
+
         auto current = std::chrono::high_resolution_clock::now( );    
         auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>( current - last );
-
-        float32 dt = (float32)elapsed.count() / 1000000000.0f;
+        uint64 dt = (uint64)elapsed.count();
  
+        bool tickDue = TickSchedulerBeginTick(&scheduler, current);
         ServerUpdate(&memory, dt);
+        if(tickDue) {
+            TickSchedulerEndTick(&scheduler, std::chrono::high_resolution_clock::now( ));
+        }
 
         last = current;
+    }
+    ServerShutdown(&memory);
+
+    free(memory.data);
+}
+
+// Run the updates of a journal back to back and report how fast they went
+void RunReplay(ServerConfig config) {
+    Memory memory;
+    memory.size = ServerMemorySize(&config);
+    memory.used = 0;
+    memory.data = (uint8 *)malloc(memory.size);
+
+    ServerInitialize(&memory, &config);
+    GameState *gameState = (GameState *)memory.data;
 
+    auto start = std::chrono::high_resolution_clock::now( );
+    uint64 dt;
+    while(ServerRunning && ServerReplayNextUpdate(&memory, &dt)) {
+        ServerUpdate(&memory, dt);
+    }
+    auto end = std::chrono::high_resolution_clock::now( );
+    float64 seconds = (float64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000000000.0;
 
+    Journal *journal = &gameState->journal;
+    printf("replayed %u updates %u datagrams %u ticks (%.1fs of game time) in %.3fs, %.0f ticks/s %.1fx realtime\n",
+           journal->updateCount, journal->datagramCount, gameState->tick, gameState->time, seconds,
+           gameState->tick / Max(seconds, 0.000001), gameState->time / Max(seconds, 0.000001));
+    if(journal->mismatchCount > 0) {
+        printf("%u updates started on a different tick than recorded, the replay diverged\n", journal->mismatchCount);
     }
-    ServerShutdown(&memory);
+    StatsPacket stats;
+    ServerGetStats(gameState, &stats);
+    PrintStatsPacket(&stats);
 
+    ServerShutdown(&memory);
     free(memory.data);
+}
+
+int32 main(int32 argc, char **argv) {
+
+    // TODO: create a utility file for this kind of functions...
+    // print current working directory
+    const size_t cwdSize = 256;
+    char cwd[cwdSize];
+    getcwd(cwd, cwdSize);
+    printf("cwd: %s\n", cwd);
+    
+    ServerConfig config;
+    config.tickRate = DefaultTickRate;
+    config.snapshotRate = DefaultSnapshotRate;
+    config.port = DefaultServerPort;
+    config.shardCount = 1;
+    config.shardIndex = 0;
+    config.interestRadius = DefaultInterestRadius;
+    config.clientBandwidth = DefaultClientBandwidth;
+    config.challengeSecret = std::random_device{}();
+    config.maxClients = DefaultMaxClientCount;
+    memset(&config.simulator, 0, sizeof(NetworkSimulatorConfig));
+    config.recordPath = nullptr;
+    config.replayPath = nullptr;
+    for(int32 i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config.tickRate = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--send-rate") == 0 && i + 1 < argc) {
+            config.snapshotRate = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            config.port = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--interest-radius") == 0 && i + 1 < argc) {
+            config.interestRadius = (float32)atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--client-bandwidth") == 0 && i + 1 < argc) {
+            config.clientBandwidth = (float32)atof(argv[++i]);
+        }
+        // bad link simulation, latency and jitter in milliseconds and chances in percent
+        else if(strcmp(argv[i], "--sim-latency") == 0 && i + 1 < argc) {
+            config.simulator.latency = (float32)atof(argv[++i]) / 1000.0f;
+        }
+        else if(strcmp(argv[i], "--sim-jitter") == 0 && i + 1 < argc) {
+            config.simulator.jitter = (float32)atof(argv[++i]) / 1000.0f;
+        }
+        else if(strcmp(argv[i], "--sim-loss") == 0 && i + 1 < argc) {
+            config.simulator.loss = (float32)atof(argv[++i]) / 100.0f;
+        }
+        else if(strcmp(argv[i], "--sim-duplicate") == 0 && i + 1 < argc) {
+            config.simulator.duplicate = (float32)atof(argv[++i]) / 100.0f;
+        }
+        else if(strcmp(argv[i], "--sim-reorder") == 0 && i + 1 < argc) {
+            config.simulator.reorder = (float32)atof(argv[++i]) / 100.0f;
+        }
+        else if(strcmp(argv[i], "--sim-bandwidth") == 0 && i + 1 < argc) {
+            config.simulator.bandwidth = (float32)atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            config.recordPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            config.replayPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+            config.maxClients = (uint32)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            config.shardCount = atoi(argv[++i]);
+            // 0 means one shard per core
+            if(config.shardCount == 0) {
+                config.shardCount = (int32)std::thread::hardware_concurrency();
+            }
+        }
+        else {
+            printf("usage: server [--tick-rate hz] [--send-rate hz] [--port port] [--shards count] [--max-clients count]\n"
+                   "              [--interest-radius meters] [--client-bandwidth bytes]\n"
+                   "              [--sim-latency ms] [--sim-jitter ms] [--sim-loss %%] [--sim-duplicate %%] [--sim-reorder %%] [--sim-bandwidth bytes]\n"
+                   "              [--record journal] [--replay journal]\n");
+            return 1;
+        }
+    }
+    signal(SIGINT, ServerStopSignal);
+    signal(SIGTERM, ServerStopSignal);
+
+    if(config.replayPath) {
+        // the journal has the settings of the recorded server
+        if(!JournalReadConfig(config.replayPath, &config)) {
+            return 1;
+        }
+        printf("replaying %s tick rate: %dhz send rate: %dhz\n", config.replayPath, config.tickRate,
+               config.tickRate / Max(1, config.tickRate / config.snapshotRate));
+        config.shardCount = 1;
+        RunReplay(config);
+        return 0;
+    }
+
+    if(config.tickRate <= 0 || config.snapshotRate <= 0 || config.snapshotRate > config.tickRate) {
+        printf("invalid tick rate %d or send rate %d\n", config.tickRate, config.snapshotRate);
+        return 1;
+    }
+    if(config.maxClients == 0 || config.maxClients > MaxEntityCount) {
+        printf("invalid max clients %u, max is %u\n", config.maxClients, MaxEntityCount);
+        return 1;
+    }
+    if(config.shardCount <= 0 || config.shardCount > MaxShardCount) {
+        printf("invalid shard count %d, max is %d\n", config.shardCount, MaxShardCount);
+        return 1;
+    }
+    printf("tick rate: %dhz send rate: %dhz shards: %d max clients per shard: %u\n", config.tickRate,
+           config.tickRate / Max(1, config.tickRate / config.snapshotRate), config.shardCount, config.maxClients);
+    if(NetworkSimulatorConfigIsActive(&config.simulator)) {
+        printf("simulating latency: %.0fms jitter: %.0fms loss: %.1f%% duplicate: %.1f%% reorder: %.1f%% bandwidth: %.0f bytes/s\n",
+               config.simulator.latency * 1000.0f, config.simulator.jitter * 1000.0f, config.simulator.loss * 100.0f,
+               config.simulator.duplicate * 100.0f, config.simulator.reorder * 100.0f, config.simulator.bandwidth);
+    }
+
+    // Every shard is a full server with its own memory, game state and socket. The sockets
+    // share the port with SO_REUSEPORT and the kernel picks the shard of each client
+    // by hashing its address, so all the packets of a client land on the same shard
+    std::thread shards[MaxShardCount];
+    for(int32 i = 0; i < config.shardCount; ++i) {
+        ServerConfig shardConfig = config;
+        shardConfig.shardIndex = i;
+        shards[i] = std::thread(RunShard, shardConfig);
+    }
+    for(int32 i = 0; i < config.shardCount; ++i) {
+        shards[i].join();
+    }
 
     return 0;
 }
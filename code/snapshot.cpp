@@ -0,0 +1,290 @@
+// Snapshot history
+
+void SnapshotHistoryClear(SnapshotHistory *history) {
+    for(int32 i = 0; i < SnapshotHistoryCount; ++i) {
+        history->snapshots[i].id = 0;
+        history->snapshots[i].valid = false;
+        history->snapshots[i].entityCount = 0;
+    }
+}
+
+Snapshot *SnapshotHistoryGet(SnapshotHistory *history, uint32 id) {
+    Snapshot *snapshot = history->snapshots + (id % SnapshotHistoryCount);
+    if(snapshot->valid && snapshot->id == id) {
+        return snapshot;
+    }
+    return nullptr;
+}
+
+Snapshot *SnapshotHistoryInsert(SnapshotHistory *history, uint32 id) {
+    Snapshot *snapshot = history->snapshots + (id % SnapshotHistoryCount);
+    snapshot->id = id;
+    snapshot->valid = true;
+    snapshot->entityCount = 0;
+    return snapshot;
+}
+
+
+// Snapshot
+
+void SnapshotSort(Snapshot *snapshot) {
+    // insertion sort, the list is small and almost always already sorted
+    for(int32 i = 1; i < snapshot->entityCount; ++i) {
+        EntitySnapshot entity = snapshot->entities[i];
+        int32 j = i - 1;
+        while(j >= 0 && snapshot->entities[j].uid > entity.uid) {
+            snapshot->entities[j + 1] = snapshot->entities[j];
+            --j;
+        }
+        snapshot->entities[j + 1] = entity;
+    }
+}
+
+static int32 SnapshotLowerBound(Snapshot *snapshot, uint32 uid) {
+    int32 low = 0;
+    int32 high = snapshot->entityCount;
+    while(low < high) {
+        int32 middle = (low + high) / 2;
+        if(snapshot->entities[middle].uid < uid) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+EntitySnapshot *SnapshotFind(Snapshot *snapshot, uint32 uid) {
+    int32 index = SnapshotLowerBound(snapshot, uid);
+    if(index < snapshot->entityCount && snapshot->entities[index].uid == uid) {
+        return snapshot->entities + index;
+    }
+    return nullptr;
+}
+
+static const int32 SnapshotEntryFlagBits = 3;
+
+// bits used by an entry: the "more entries" bit, the uid, the flags and the fields
+static int32 SnapshotEntryBits(uint8 flags) {
+    int32 bits = 1 + 32 + SnapshotEntryFlagBits;
+    if(flags & SNAPSHOT_ENTITY_POS) bits += 2 * QuantizedPositionBits;
+    if(flags & SNAPSHOT_ENTITY_VEL) bits += 2 * QuantizedVelocityBits;
+    return bits;
+}
+
+static void SnapshotWriteEntry(BitStream *stream, EntitySnapshot *entity, uint8 flags) {
+    BitStreamWriteBool(stream, true);
+    BitStreamWriteBits(stream, entity->uid, 32);
+    BitStreamWriteBits(stream, flags, SnapshotEntryFlagBits);
+    if(flags & SNAPSHOT_ENTITY_POS) {
+        BitStreamWriteVec2(stream, entity->pos, QuantizedPositionMin, QuantizedPositionMax, QuantizedPositionBits);
+    }
+    if(flags & SNAPSHOT_ENTITY_VEL) {
+        BitStreamWriteVec2(stream, entity->vel, QuantizedVelocityMin, QuantizedVelocityMax, QuantizedVelocityBits);
+    }
+}
+
+struct SnapshotDeltaEntry {
+    EntitySnapshot *base;
+    EntitySnapshot *curr;
+    int32 currIndex;
+    uint8 flags;
+    bool written;
+    float32 priority;
+};
+
+// Write the entities of current as a delta against baseline (nullptr means the client has
+// nothing). Entities that are new are sent whole, entities that are in both only send the
+// fields that changed and entities that are only in the baseline are sent as removed.
+// The entries are written by descending priorities (one per entity of current, nullptr
+// writes them by uid) until the stream is full, removals always go first. current is
+// then updated to what the client will have after reading the packet, so it can be used
+// as the baseline of future snapshots. If outUpToDate is not nullptr it is filled, by
+// index of current before the update, with the entities the client will have up to
+// date. current must already be quantized
+void SnapshotWriteDelta(BitStream *stream, Snapshot *baseline, Snapshot *current, float32 *priorities, bool *outUpToDate) {
+    Snapshot empty;
+    empty.entityCount = 0;
+    if(baseline == nullptr) {
+        baseline = &empty;
+    }
+    if(outUpToDate) {
+        memset(outUpToDate, 0, sizeof(bool) * current->entityCount);
+    }
+
+    SnapshotDeltaEntry entries[MaxSnapshotEntityCount * 2];
+    int32 entryCount = 0;
+
+    Snapshot result;
+    result.entityCount = 0;
+    // entities the client keeps if none of the entries get written
+    int32 knownCount = 0;
+
+    int32 baseIndex = 0;
+    int32 currIndex = 0;
+    while(baseIndex < baseline->entityCount || currIndex < current->entityCount) {
+        EntitySnapshot *base = baseIndex < baseline->entityCount ? baseline->entities + baseIndex : nullptr;
+        EntitySnapshot *curr = currIndex < current->entityCount ? current->entities + currIndex : nullptr;
+
+        SnapshotDeltaEntry entry = {};
+        if(curr && (base == nullptr || curr->uid < base->uid)) {
+            // new entity
+            entry.curr = curr;
+            entry.currIndex = currIndex;
+            entry.flags = SNAPSHOT_ENTITY_POS | SNAPSHOT_ENTITY_VEL;
+            entry.priority = priorities ? priorities[currIndex] : 0;
+            ++currIndex;
+        }
+        else if(base && (curr == nullptr || base->uid < curr->uid)) {
+            // removed entity
+            entry.base = base;
+            entry.currIndex = -1;
+            entry.flags = SNAPSHOT_ENTITY_REMOVED;
+            entry.priority = SnapshotMaxPriority;
+            ++baseIndex;
+        }
+        else {
+            uint8 flags = 0;
+            if(memcmp(&base->pos, &curr->pos, sizeof(Vec2)) != 0) flags |= SNAPSHOT_ENTITY_POS;
+            if(memcmp(&base->vel, &curr->vel, sizeof(Vec2)) != 0) flags |= SNAPSHOT_ENTITY_VEL;
+            ++baseIndex;
+            if(flags == 0) {
+                // the client already has it, it costs nothing
+                result.entities[result.entityCount++] = *curr;
+                if(outUpToDate) {
+                    outUpToDate[currIndex] = true;
+                }
+                ++knownCount;
+                ++currIndex;
+                continue;
+            }
+            entry.base = base;
+            entry.curr = curr;
+            entry.currIndex = currIndex;
+            entry.flags = flags;
+            entry.priority = priorities ? priorities[currIndex] : 0;
+            ++currIndex;
+        }
+        if(entry.base) {
+            ++knownCount;
+        }
+        entries[entryCount++] = entry;
+    }
+
+    if(priorities) {
+        // stable insertion sort by descending priority
+        for(int32 i = 1; i < entryCount; ++i) {
+            SnapshotDeltaEntry entry = entries[i];
+            int32 j = i - 1;
+            while(j >= 0 && entries[j].priority < entry.priority) {
+                entries[j + 1] = entries[j];
+                --j;
+            }
+            entries[j + 1] = entry;
+        }
+    }
+
+    for(int32 i = 0; i < entryCount; ++i) {
+        SnapshotDeltaEntry *entry = entries + i;
+        // keep one bit for the end of the list
+        int32 bitsLeft = (int32)BitStreamBitsLeft(stream) - 1;
+        if(SnapshotEntryBits(entry->flags) > bitsLeft) {
+            // a smaller entry can still fit
+            continue;
+        }
+        if(entry->base == nullptr && knownCount >= MaxSnapshotEntityCount) {
+            continue;
+        }
+        SnapshotWriteEntry(stream, entry->curr ? entry->curr : entry->base, entry->flags);
+        entry->written = true;
+        if(entry->base == nullptr) ++knownCount;
+        if(entry->curr == nullptr) --knownCount;
+    }
+
+    BitStreamWriteBool(stream, false);
+
+    for(int32 i = 0; i < entryCount; ++i) {
+        SnapshotDeltaEntry *entry = entries + i;
+        EntitySnapshot *known = entry->written ? entry->curr : entry->base;
+        if(known) {
+            ASSERT(result.entityCount < MaxSnapshotEntityCount);
+            result.entities[result.entityCount++] = *known;
+        }
+        if(entry->written && entry->curr && outUpToDate) {
+            outUpToDate[entry->currIndex] = true;
+        }
+    }
+    SnapshotSort(&result);
+
+    memcpy(current->entities, result.entities, sizeof(EntitySnapshot) * result.entityCount);
+    current->entityCount = result.entityCount;
+}
+
+// Rebuild a snapshot from baseline (nullptr if the delta is not against a baseline) and
+// the entries in the stream. If outUpdated is not nullptr it is filled, by index of
+// outSnapshot, with the entities this packet wrote. The others kept the baseline state,
+// either because they didn't change or because the server deferred them to a later
+// packet. Returns false if the packet is malformed
+bool SnapshotReadDelta(BitStream *stream, Snapshot *baseline, Snapshot *outSnapshot, bool *outUpdated) {
+    outSnapshot->entityCount = 0;
+    if(baseline) {
+        memcpy(outSnapshot->entities, baseline->entities, sizeof(EntitySnapshot) * baseline->entityCount);
+        outSnapshot->entityCount = baseline->entityCount;
+    }
+    if(outUpdated) {
+        memset(outUpdated, 0, sizeof(bool) * MaxSnapshotEntityCount);
+    }
+
+    while(BitStreamReadBool(stream)) {
+        uint32 uid = BitStreamReadBits(stream, 32);
+        uint8 flags = (uint8)BitStreamReadBits(stream, SnapshotEntryFlagBits);
+        if(stream->overflow) {
+            return false;
+        }
+
+        int32 index = SnapshotLowerBound(outSnapshot, uid);
+        bool found = index < outSnapshot->entityCount && outSnapshot->entities[index].uid == uid;
+
+        if(flags & SNAPSHOT_ENTITY_REMOVED) {
+            if(found) {
+                memmove(outSnapshot->entities + index, outSnapshot->entities + index + 1,
+                        sizeof(EntitySnapshot) * (outSnapshot->entityCount - index - 1));
+                if(outUpdated) {
+                    memmove(outUpdated + index, outUpdated + index + 1,
+                            sizeof(bool) * (outSnapshot->entityCount - index - 1));
+                }
+                outSnapshot->entityCount--;
+            }
+            continue;
+        }
+
+        if(!found) {
+            if(outSnapshot->entityCount >= MaxSnapshotEntityCount) {
+                return false;
+            }
+            memmove(outSnapshot->entities + index + 1, outSnapshot->entities + index,
+                    sizeof(EntitySnapshot) * (outSnapshot->entityCount - index));
+            if(outUpdated) {
+                memmove(outUpdated + index + 1, outUpdated + index, sizeof(bool) * (outSnapshot->entityCount - index));
+            }
+            outSnapshot->entityCount++;
+            EntitySnapshot *entity = outSnapshot->entities + index;
+            entity->uid = uid;
+            entity->pos = Vec2();
+            entity->vel = Vec2();
+        }
+
+        EntitySnapshot *entity = outSnapshot->entities + index;
+        if(outUpdated) {
+            outUpdated[index] = true;
+        }
+        if(flags & SNAPSHOT_ENTITY_POS) {
+            entity->pos = BitStreamReadVec2(stream, QuantizedPositionMin, QuantizedPositionMax, QuantizedPositionBits);
+        }
+        if(flags & SNAPSHOT_ENTITY_VEL) {
+            entity->vel = BitStreamReadVec2(stream, QuantizedVelocityMin, QuantizedVelocityMax, QuantizedVelocityBits);
+        }
+    }
+    return !stream->overflow;
+}
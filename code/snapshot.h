@@ -0,0 +1,43 @@
+// World snapshots shared by the server and the client. A snapshot is the list of
+// entity states one client knows about for a given server tick, sorted by uid.
+// Snapshots are sent as a delta against a baseline the client has acknowledged
+
+static const int32 MaxSnapshotEntityCount = 128;
+static const int32 SnapshotHistoryCount = 32;
+// entries with this priority are written before any other
+static const float32 SnapshotMaxPriority = 3.4e38f;
+// states of every remote entity the client keeps to interpolate between
+static const int32 InterpolationBufferSize = 16;
+
+enum SnapshotEntityFlag {
+    SNAPSHOT_ENTITY_POS     = 1 << 0,
+    SNAPSHOT_ENTITY_VEL     = 1 << 1,
+    SNAPSHOT_ENTITY_REMOVED = 1 << 2
+};
+
+struct EntitySnapshot {
+    uint32 uid;
+    Vec2 pos;
+    Vec2 vel;
+};
+
+struct Snapshot {
+    uint32 id;
+    bool32 valid;
+    int32 entityCount;
+    EntitySnapshot entities[MaxSnapshotEntityCount];
+};
+
+struct SnapshotHistory {
+    Snapshot snapshots[SnapshotHistoryCount];
+};
+
+void SnapshotHistoryClear(SnapshotHistory *history);
+Snapshot *SnapshotHistoryGet(SnapshotHistory *history, uint32 id);
+Snapshot *SnapshotHistoryInsert(SnapshotHistory *history, uint32 id);
+
+void SnapshotSort(Snapshot *snapshot);
+EntitySnapshot *SnapshotFind(Snapshot *snapshot, uint32 uid);
+void SnapshotWriteDelta(BitStream *stream, Snapshot *baseline, Snapshot *current,
+                        float32 *priorities = nullptr, bool *outUpToDate = nullptr);
+bool SnapshotReadDelta(BitStream *stream, Snapshot *baseline, Snapshot *outSnapshot, bool *outUpdated = nullptr);